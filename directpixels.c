@@ -10,16 +10,27 @@
  *  See bottom of file to see updates.
  */
 //#define DP_BUILD_WINDOWS
+#if defined(__linux__) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L /* <- For clock_gettime */
+#endif
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
 #include "platformtest.h"
 
 #if defined(DP_BUILD_WINDOWS)
 #include <windows.h>
 #include <windowsx.h>
 #elif defined(DP_BUILD_LINUX)
+#include <pthread.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DP_SIMD_SSE2
+#include <emmintrin.h>
 #endif
 
 #include "directpixels.h"
@@ -27,6 +38,21 @@
 #define DP_MAX_KEYS 512
 #define DP_MAX_BUTTONS 16
 #define DP_TITLE_LENGTH 128
+#define DP_MAX_THREADS 16
+#define DP_MAX_LAYERS 32
+#define DP_MAX_DAMAGE_RECTS 16
+#define DP_MAX_FILTER_PASSES 32
+#define DP_FILTER_MAX_RADIUS 127
+#define DP_FILTER_BAND 16 /* <- Rows per job for row passes */
+#define DP_FILTER_STRIP 16 /* <- Columns per job for column passes, one cache line of pixels */
+#define DP_RASTER_TILE 32 /* <- Pixels per side of a raster tile */
+#define DP_RASTER_SUBPIXEL 16 /* <- Vertex positions snap to 1/16 of a pixel */
+#define DP_GFX_STACK_DEPTH 16
+#define DP_TILEMAP_CACHE 64 /* <- Default number of prerendered chunks kept around */
+#define DP_RECORD_BATCH 4096 /* <- putPixel calls buffered into one command */
+#define DP_RECORD_MAGIC 0x53435044 /* <- "DPCS" */
+#define DP_RECORD_VERSION 1
+#define DP_PARALLEL_MIN_PIXELS (256 * 256) /* <- Below this spawning threads costs more than it saves */
 
 #define ECHO(a) printf("-> Pos: %d <-\n", a);
 
@@ -34,6 +60,15 @@
 LRESULT CALLBACK WindProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
 #endif
 
+/* Recorder hooks, defined with the recorder functions */
+static void _dprec_pixel(dpRecorder *, dpBuffer *, const int32_t, const int32_t, const dpPixel);
+static void _dprec_clear(dpRecorder *, dpBuffer *);
+static void _dprec_input(dpRecorder *, dpWindow *);
+static void _dprec_frame(dpRecorder *, dpBuffer *);
+static void _dprec_detachBuffer(dpRecorder *, dpBuffer *);
+static void _dprec_blit(dpRecorder *, dpBuffer *, dpBuffer *, const int32_t, const int32_t, const int32_t, const int32_t, const uint32_t, const uint32_t);
+static void _dpbuf_fill(dpBuffer *, const int32_t, const int32_t, const int32_t, const int32_t, const dpPixel, const int32_t);
+
 /* Structure Definitions */
 
 typedef struct dpWindowStruct {
@@ -46,6 +81,7 @@ typedef struct dpWindowStruct {
     int32_t mousey;
     int32_t open;
     int32_t id;
+    dpRecorder *recorder;
 #if defined(DP_BUILD_WINDOWS)
     WNDCLASS wc;
     HWND hwnd;
@@ -60,11 +96,119 @@ typedef struct dpBufferStruct {
     uint32_t length;
     dpPixel clearcolor;
     dpPixel *pixels;
+    dpRecorder *recorder;
+    uint32_t recordid;
 #if defined(DP_BUILD_WINDOWS)
     BITMAPINFO bitmapinfo;
 #endif
 } dpBuffer;
 
+typedef struct _dpRectStruct {
+    int32_t x0;
+    int32_t y0;
+    int32_t x1; /* <- Exclusive */
+    int32_t y1; /* <- Exclusive */
+} _dpRect;
+
+typedef struct dpLayerStruct {
+    dpBuffer *buffer;
+    dpCompositor *compositor;
+    int32_t x;
+    int32_t y;
+    int32_t z;
+    int32_t blendmode;
+    uint32_t opacity;
+    int32_t visible;
+    int32_t damaged;
+    _dpRect damage; /* <- In layer space, only valid while damaged is set */
+} dpLayer;
+
+typedef struct dpCompositorStruct {
+    dpBuffer *output;
+    dpLayer *layers[DP_MAX_LAYERS]; /* <- Sorted back to front by z */
+    uint32_t layercount;
+    _dpRect damage[DP_MAX_DAMAGE_RECTS]; /* <- In output space, never overlapping */
+    uint32_t damagecount;
+    uint32_t threads;
+} dpCompositor;
+
+typedef struct _dpFilterPassStruct {
+    int32_t type;
+    uint32_t param; /* <- Radius, LUT size, scanline period or palette size */
+    uint32_t amount; /* <- Multiplier out of 255 for scanlines and masks */
+    uint8_t *table; /* <- 1D LUT or quantize map */
+    uint32_t *lookup; /* <- 3D LUT cell index and weight per channel value */
+    dpPixel *colors; /* <- 3D LUT entries or palette */
+} _dpFilterPass;
+
+typedef struct dpFilterStruct {
+    _dpFilterPass passes[DP_MAX_FILTER_PASSES];
+    uint32_t passcount;
+    uint32_t threads;
+} dpFilter;
+
+typedef struct _dpTriangleStruct {
+    int32_t minx; /* <- Pixel bounds, max is exclusive */
+    int32_t miny;
+    int32_t maxx;
+    int32_t maxy;
+    int64_t a[3]; /* <- Edge functions a * x + b * y + c in subpixels, inside is >= 0 */
+    int64_t b[3];
+    int64_t c[3];
+    float zmin;
+    float zmax;
+    float planes[4][3]; /* <- Depth, red, green and blue as f(x, y) = p[0] * x + p[1] * y + p[2] */
+    dpPixel color; /* <- Whole triangle color when flat shaded */
+    int32_t flat;
+} _dpTriangle;
+
+typedef struct dpRasterStruct {
+    uint32_t width;
+    uint32_t height;
+    float *depth;
+    uint32_t tilesx;
+    uint32_t tilesy;
+    float *tilezmax; /* <- Farthest depth in each tile, never less than the real one */
+    dpMat4 model;
+    dpMat4 viewprojection;
+    int32_t shading;
+    int32_t culling;
+    int32_t lighting;
+    dpVec3 light;
+    float ambient;
+    uint32_t threads;
+    _dpTriangle *triangles;
+    uint32_t trianglecount;
+    uint32_t trianglecapacity;
+    uint32_t *binstart; /* <- Where each tile's triangle indices start in bins */
+    uint32_t *bins;
+    uint32_t bincapacity;
+} dpRaster;
+
+typedef struct _dpChunkStruct {
+    dpBuffer *buffer; /* <- NULL until the chunk is first seen or after it was evicted */
+    int32_t dirty;
+    uint32_t lastused; /* <- Frame the chunk was last drawn, for eviction */
+} _dpChunk;
+
+typedef struct dpTilemapStruct {
+    uint32_t width; /* <- In tiles */
+    uint32_t height;
+    uint16_t *tiles;
+    dpBuffer *tileset;
+    uint32_t tilewidth;
+    uint32_t tileheight;
+    uint32_t tilesetcolumns;
+    uint32_t tilecount;
+    dpPixel clearcolor;
+    _dpChunk *chunks;
+    uint32_t chunksx;
+    uint32_t chunksy;
+    uint32_t cached;
+    uint32_t cachesize;
+    uint32_t frame;
+} dpTilemap;
+
 
 /* Window structure functions */
 
@@ -79,8 +223,9 @@ dpWindow *dpwin_create(const char *title, const uint32_t width, const uint32_t h
     dpwin->mousex = 0;
     dpwin->mousey = 0;
     dpwin->open = 0;
-    memset(dpwin->keys, 0, DP_MAX_KEYS);
-    memset(dpwin->buttons, 0, DP_MAX_BUTTONS);
+    dpwin->recorder = NULL;
+    memset(dpwin->keys, 0, sizeof(dpwin->keys));
+    memset(dpwin->buttons, 0, sizeof(dpwin->buttons));
 
 #if defined(DP_BUILD_WINDOWS)
     HINSTANCE hInstance = GetModuleHandle(NULL);
@@ -136,9 +281,13 @@ void dpwin_tick(dpWindow *dpwin) {
     }
 #elif defined(DP_BUILD_LINUX)
 #endif
+    if(dpwin->recorder != NULL)
+        _dprec_input(dpwin->recorder, dpwin);
 }
 
 void dpwin_putBuffer(dpWindow *dpwin, dpBuffer *dpbuf) {
+    if(dpbuf->recorder != NULL)
+        _dprec_frame(dpbuf->recorder, dpbuf);
 #if defined(DP_BUILD_WINDOWS)
     RECT rect;
     GetClientRect(dpwin->hwnd, &rect);
@@ -187,6 +336,8 @@ int32_t dpwin_getButton(dpWindow *dpwin, const int32_t buttoncode) {
 }
 
 void dpwin_destroy(dpWindow *dpwin) {
+    if(dpwin->recorder != NULL)
+        dprec_attachWindow(dpwin->recorder, NULL);
 #if defined(DP_BUILD_WINDOWS)
     DeleteDC(dpwin->hdc);
     DestroyWindow(dpwin->hwnd);
@@ -293,6 +444,8 @@ dpBuffer *dpbuf_create(const uint32_t width, const uint32_t height) {
     dpbuf->length = dpbuf->width * dpbuf->height;
     dpbuf->clearcolor = dppix_hex(0x0);
     dpbuf->pixels = malloc(sizeof(dpPixel) * dpbuf->length);
+    dpbuf->recorder = NULL;
+    dpbuf->recordid = 0;
     dpbuf_clear(dpbuf);
 #if defined(DP_BUILD_WINDOWS)
     dpbuf->bitmapinfo.bmiHeader.biSize = sizeof(dpbuf->bitmapinfo.bmiHeader);
@@ -307,25 +460,68 @@ dpBuffer *dpbuf_create(const uint32_t width, const uint32_t height) {
 
 void dpbuf_clear(dpBuffer *dpbuf) {
     uint32_t i;
+    if(dpbuf->recorder != NULL)
+        _dprec_clear(dpbuf->recorder, dpbuf);
     for(i = 0; i < dpbuf->length; i++)
         dpbuf->pixels[i] = dpbuf->clearcolor;
 }
 
 void dpbuf_putPixel(dpBuffer *dpbuf, const int32_t x, const int32_t y, const dpPixel pixel) {
+    if(dpbuf->recorder != NULL)
+        _dprec_pixel(dpbuf->recorder, dpbuf, x, y, pixel);
     if(x >= 0 && y >= 0 && x < dpbuf->width && y < dpbuf->height)
         dpbuf->pixels[y * dpbuf->width + x] = pixel;
 }
 
 void dpbuf_putPixel3(dpBuffer *dpbuf, const int32_t x, const int32_t y, const uint8_t r, const uint8_t g, const uint8_t b) {
+    if(dpbuf->recorder != NULL)
+        _dprec_pixel(dpbuf->recorder, dpbuf, x, y, dppix_rgb(r, g, b));
     if(x >= 0 && y >= 0 && x < dpbuf->width && y < dpbuf->height)
         dpbuf->pixels[y * dpbuf->width + x] = dppix_rgb(r, g, b);
 }
 
 void dpbuf_putPixel4(dpBuffer *dpbuf, const int32_t x, const int32_t y, const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a) {
+    if(dpbuf->recorder != NULL)
+        _dprec_pixel(dpbuf->recorder, dpbuf, x, y, dppix_rgba(r, g, b, a));
     if(x >= 0 && y >= 0 && x < dpbuf->width && y < dpbuf->height)
         dpbuf->pixels[y * dpbuf->width + x] = dppix_rgba(r, g, b, a);
 }
 
+void dpbuf_fill(dpBuffer *dpbuf, const int32_t x, const int32_t y, const uint32_t width, const uint32_t height, const dpPixel pixel) {
+    _dpbuf_fill(dpbuf, x, y, (int32_t)width, (int32_t)height, pixel, DP_BLEND_COPY);
+}
+
+/* Copies a width by height block from (sx, sy) in src to (dx, dy) in dst, clipped to both */
+void dpbuf_blit(dpBuffer *dst, dpBuffer *src, const int32_t dx, const int32_t dy, const int32_t sx, const int32_t sy, const uint32_t width, const uint32_t height) {
+    int32_t x0 = 0, y0 = 0, x1 = (int32_t)width, y1 = (int32_t)height, y;
+    /* Clip the block (x0, y0)-(x1, y1) against both buffers */
+    x0 = -dx > x0 ? -dx : x0;
+    x0 = -sx > x0 ? -sx : x0;
+    y0 = -dy > y0 ? -dy : y0;
+    y0 = -sy > y0 ? -sy : y0;
+    x1 = (int32_t)dst->width - dx < x1 ? (int32_t)dst->width - dx : x1;
+    x1 = (int32_t)src->width - sx < x1 ? (int32_t)src->width - sx : x1;
+    y1 = (int32_t)dst->height - dy < y1 ? (int32_t)dst->height - dy : y1;
+    y1 = (int32_t)src->height - sy < y1 ? (int32_t)src->height - sy : y1;
+    if(x0 >= x1 || y0 >= y1)
+        return;
+    if(dst->recorder != NULL) {
+        if(src->recorder != dst->recorder)
+            dprec_attachBuffer(dst->recorder, src);
+        _dprec_blit(dst->recorder, dst, src, dx + x0, dy + y0, sx + x0, sy + y0, (uint32_t)(x1 - x0), (uint32_t)(y1 - y0));
+    }
+    if(src == dst && dy > sy) {
+        /* Blitting down within one buffer, go bottom up so rows are read before being written */
+        for(y = y1 - 1; y >= y0; y--)
+            memmove(dst->pixels + (uint32_t)(dy + y) * dst->width + (uint32_t)(dx + x0),
+                src->pixels + (uint32_t)(sy + y) * src->width + (uint32_t)(sx + x0), sizeof(dpPixel) * (uint32_t)(x1 - x0));
+        return;
+    }
+    for(y = y0; y < y1; y++)
+        memmove(dst->pixels + (uint32_t)(dy + y) * dst->width + (uint32_t)(dx + x0),
+            src->pixels + (uint32_t)(sy + y) * src->width + (uint32_t)(sx + x0), sizeof(dpPixel) * (uint32_t)(x1 - x0));
+}
+
 void dpbuf_setClearColor(dpBuffer *dpbuf, const dpPixel pixel) {
     dpbuf->clearcolor = pixel;
 }
@@ -335,11 +531,1488 @@ dpPixel *dpbuf_getPixelPointer(dpBuffer *dpbuf) {
 }
 
 void dpbuf_destroy(dpBuffer *dpbuf) {
+    if(dpbuf->recorder != NULL)
+        _dprec_detachBuffer(dpbuf->recorder, dpbuf);
     free(dpbuf->pixels);
     free(dpbuf);
 }
 
 
+/* Rectangle helper functions */
+
+static _dpRect _dprect_make(const int32_t x0, const int32_t y0, const int32_t x1, const int32_t y1) {
+    _dpRect r = { x0, y0, x1, y1 };
+    return r;
+}
+
+static int32_t _dprect_isEmpty(const _dpRect r) {
+    return r.x0 >= r.x1 || r.y0 >= r.y1;
+}
+
+static _dpRect _dprect_intersect(const _dpRect a, const _dpRect b) {
+    _dpRect r = {
+        a.x0 > b.x0 ? a.x0 : b.x0,
+        a.y0 > b.y0 ? a.y0 : b.y0,
+        a.x1 < b.x1 ? a.x1 : b.x1,
+        a.y1 < b.y1 ? a.y1 : b.y1
+    };
+    return r;
+}
+
+static _dpRect _dprect_union(const _dpRect a, const _dpRect b) {
+    _dpRect r = {
+        a.x0 < b.x0 ? a.x0 : b.x0,
+        a.y0 < b.y0 ? a.y0 : b.y0,
+        a.x1 > b.x1 ? a.x1 : b.x1,
+        a.y1 > b.y1 ? a.y1 : b.y1
+    };
+    return r;
+}
+
+static int64_t _dprect_area(const _dpRect r) {
+    return _dprect_isEmpty(r) ? 0 : (int64_t)(r.x1 - r.x0) * (int64_t)(r.y1 - r.y0);
+}
+
+
+/* Worker thread functions */
+
+/*
+ *  Splits a job count across a handful of threads. Threads are spawned per call
+ *  and joined before returning, so callers should only bother when there is enough
+ *  work (see DP_PARALLEL_MIN_PIXELS). Each thread takes every n-th job, no locking
+ *  is needed as long as jobs write to disjoint memory.
+ *  On platforms without a thread implementation everything runs on the caller.
+ */
+
+typedef void (*_dpJobFunc)(void *, const uint32_t);
+
+typedef struct _dpWorkerStruct {
+    _dpJobFunc func;
+    void *data;
+    uint32_t first;
+    uint32_t jobs;
+    uint32_t stride;
+} _dpWorker;
+
+static void _dp_workerRun(_dpWorker *worker) {
+    uint32_t i;
+    for(i = worker->first; i < worker->jobs; i += worker->stride)
+        worker->func(worker->data, i);
+}
+
+#if defined(DP_BUILD_WINDOWS)
+static DWORD WINAPI _dp_workerProc(LPVOID param) {
+    _dp_workerRun((_dpWorker *)param);
+    return 0;
+}
+#elif defined(DP_BUILD_LINUX)
+static void *_dp_workerProc(void *param) {
+    _dp_workerRun((_dpWorker *)param);
+    return NULL;
+}
+#endif
+
+static void _dp_runJobs(_dpJobFunc func, void *data, const uint32_t jobs, uint32_t threads) {
+    _dpWorker workers[DP_MAX_THREADS];
+    uint32_t i;
+    if(threads > DP_MAX_THREADS)
+        threads = DP_MAX_THREADS;
+    if(threads > jobs)
+        threads = jobs;
+    if(threads <= 1) {
+        for(i = 0; i < jobs; i++)
+            func(data, i);
+        return;
+    }
+    for(i = 0; i < threads; i++) {
+        workers[i].func = func;
+        workers[i].data = data;
+        workers[i].first = i;
+        workers[i].jobs = jobs;
+        workers[i].stride = threads;
+    }
+#if defined(DP_BUILD_WINDOWS)
+    HANDLE handles[DP_MAX_THREADS];
+    for(i = 1; i < threads; i++)
+        handles[i] = CreateThread(NULL, 0, _dp_workerProc, &workers[i], 0, NULL);
+    _dp_workerRun(&workers[0]);
+    for(i = 1; i < threads; i++) {
+        if(handles[i] == NULL) {
+            _dp_workerRun(&workers[i]); /* <- Could not spawn, do it ourselves */
+            continue;
+        }
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+    }
+#elif defined(DP_BUILD_LINUX)
+    pthread_t handles[DP_MAX_THREADS];
+    int32_t spawned[DP_MAX_THREADS];
+    for(i = 1; i < threads; i++)
+        spawned[i] = pthread_create(&handles[i], NULL, _dp_workerProc, &workers[i]) == 0;
+    _dp_workerRun(&workers[0]);
+    for(i = 1; i < threads; i++) {
+        if(!spawned[i]) {
+            _dp_workerRun(&workers[i]); /* <- Could not spawn, do it ourselves */
+            continue;
+        }
+        pthread_join(handles[i], NULL);
+    }
+#else
+    for(i = 0; i < threads; i++)
+        _dp_workerRun(&workers[i]);
+#endif
+}
+
+
+/* Blending functions */
+
+/* Exact round(x / 255) for 0 <= x <= 255 * 255 */
+#define DP_DIV255(x) ((((x) + 128) + (((x) + 128) >> 8)) >> 8)
+
+static uint8_t _dp_lerp8(const uint32_t d, const uint32_t s, const uint32_t w) {
+    return (uint8_t)DP_DIV255(s * w + d * (255 - w));
+}
+
+static uint8_t _dp_add8(const uint32_t d, const uint32_t s, const uint32_t opacity) {
+    uint32_t v = d + DP_DIV255(s * opacity);
+    return (uint8_t)(v > 255 ? 255 : v);
+}
+
+static uint8_t _dp_mult8(const uint32_t d, const uint32_t s, const uint32_t opacity) {
+    uint32_t m = DP_DIV255(s * opacity + 255 * (255 - opacity));
+    return (uint8_t)DP_DIV255(d * m);
+}
+
+static dpPixel _dp_blendPixel(const dpPixel d, const dpPixel s, const int32_t mode, const uint32_t opacity) {
+    dpPixel p;
+    uint32_t w;
+    switch(mode) {
+        case DP_BLEND_ADD:
+            p.b = _dp_add8(d.b, s.b, opacity);
+            p.g = _dp_add8(d.g, s.g, opacity);
+            p.r = _dp_add8(d.r, s.r, opacity);
+            p.a = _dp_add8(d.a, s.a, opacity);
+            break;
+        case DP_BLEND_MULTIPLY:
+            p.b = _dp_mult8(d.b, s.b, opacity);
+            p.g = _dp_mult8(d.g, s.g, opacity);
+            p.r = _dp_mult8(d.r, s.r, opacity);
+            p.a = _dp_mult8(d.a, s.a, opacity);
+            break;
+        case DP_BLEND_ALPHA:
+        default:
+            w = mode == DP_BLEND_ALPHA ? DP_DIV255(s.a * opacity) : opacity;
+            p.b = _dp_lerp8(d.b, s.b, w);
+            p.g = _dp_lerp8(d.g, s.g, w);
+            p.r = _dp_lerp8(d.r, s.r, w);
+            p.a = _dp_lerp8(d.a, s.a, w);
+            break;
+    }
+    return p;
+}
+
+#if defined(DP_SIMD_SSE2)
+/* Same math as the scalar versions above, eight 16 bit channels (two pixels) at a time */
+static __m128i _dp_div255x8(const __m128i x) {
+    __m128i t = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static __m128i _dp_lerpx8(const __m128i d, const __m128i s, const __m128i w) {
+    __m128i iw = _mm_sub_epi16(_mm_set1_epi16(255), w);
+    return _dp_div255x8(_mm_add_epi16(_mm_mullo_epi16(s, w), _mm_mullo_epi16(d, iw)));
+}
+
+/* Returns how many pixels were blended, the caller finishes the tail */
+static uint32_t _dp_blendSpanSSE2(dpPixel *dst, const dpPixel *src, const uint32_t count, const int32_t mode, const uint32_t opacity) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i op = _mm_set1_epi16((short)opacity);
+    const __m128i invop = _mm_set1_epi16((short)(255 * (255 - opacity)));
+    __m128i s, d, slo, shi, dlo, dhi, wlo, whi;
+    uint32_t i;
+    for(i = 0; i + 4 <= count; i += 4) {
+        s = _mm_loadu_si128((const __m128i *)(src + i));
+        d = _mm_loadu_si128((const __m128i *)(dst + i));
+        slo = _mm_unpacklo_epi8(s, zero);
+        shi = _mm_unpackhi_epi8(s, zero);
+        switch(mode) {
+            case DP_BLEND_ADD:
+                s = _mm_packus_epi16(_dp_div255x8(_mm_mullo_epi16(slo, op)), _dp_div255x8(_mm_mullo_epi16(shi, op)));
+                d = _mm_adds_epu8(d, s);
+                break;
+            case DP_BLEND_MULTIPLY:
+                dlo = _mm_unpacklo_epi8(d, zero);
+                dhi = _mm_unpackhi_epi8(d, zero);
+                wlo = _dp_div255x8(_mm_add_epi16(_mm_mullo_epi16(slo, op), invop));
+                whi = _dp_div255x8(_mm_add_epi16(_mm_mullo_epi16(shi, op), invop));
+                d = _mm_packus_epi16(_dp_div255x8(_mm_mullo_epi16(dlo, wlo)), _dp_div255x8(_mm_mullo_epi16(dhi, whi)));
+                break;
+            case DP_BLEND_ALPHA:
+                dlo = _mm_unpacklo_epi8(d, zero);
+                dhi = _mm_unpackhi_epi8(d, zero);
+                wlo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF); /* <- Alpha to every channel */
+                whi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF);
+                wlo = _dp_div255x8(_mm_mullo_epi16(wlo, op));
+                whi = _dp_div255x8(_mm_mullo_epi16(whi, op));
+                d = _mm_packus_epi16(_dp_lerpx8(dlo, slo, wlo), _dp_lerpx8(dhi, shi, whi));
+                break;
+            default:
+                dlo = _mm_unpacklo_epi8(d, zero);
+                dhi = _mm_unpackhi_epi8(d, zero);
+                d = _mm_packus_epi16(_dp_lerpx8(dlo, slo, op), _dp_lerpx8(dhi, shi, op));
+                break;
+        }
+        _mm_storeu_si128((__m128i *)(dst + i), d);
+    }
+    return i;
+}
+#endif
+
+static void _dp_blendSpan(dpPixel *dst, const dpPixel *src, const uint32_t count, const int32_t mode, const uint32_t opacity) {
+    uint32_t i = 0;
+    if(mode == DP_BLEND_COPY && opacity == 255) {
+        memcpy(dst, src, sizeof(dpPixel) * count);
+        return;
+    }
+#if defined(DP_SIMD_SSE2)
+    i = _dp_blendSpanSSE2(dst, src, count, mode, opacity);
+#endif
+    for(; i < count; i++)
+        dst[i] = _dp_blendPixel(dst[i], src[i], mode, opacity);
+}
+
+
+/* Compositor structure functions */
+
+typedef struct _dpCompJobStruct {
+    dpCompositor *comp;
+    _dpRect rect;
+    int32_t bandheight;
+} _dpCompJob;
+
+static _dpRect _dplayer_screenRect(dpLayer *dplayer) {
+    return _dprect_make(dplayer->x, dplayer->y, dplayer->x + (int32_t)dplayer->buffer->width, dplayer->y + (int32_t)dplayer->buffer->height);
+}
+
+/* Adds a rectangle to the damage list, merging anything it touches so the list never overlaps */
+static void _dpcomp_addDamage(dpCompositor *dpcomp, _dpRect r) {
+    uint32_t i, best;
+    int64_t cost, bestcost;
+    r = _dprect_intersect(r, _dprect_make(0, 0, dpcomp->output->width, dpcomp->output->height));
+    if(_dprect_isEmpty(r))
+        return;
+    for(i = 0; i < dpcomp->damagecount; ) {
+        _dpRect d = dpcomp->damage[i];
+        if(r.x0 <= d.x1 && d.x0 <= r.x1 && r.y0 <= d.y1 && d.y0 <= r.y1) {
+            r = _dprect_union(r, d);
+            dpcomp->damage[i] = dpcomp->damage[--dpcomp->damagecount];
+            i = 0; /* <- The bigger rectangle may touch ones we already passed */
+            continue;
+        }
+        i++;
+    }
+    while(dpcomp->damagecount == DP_MAX_DAMAGE_RECTS) {
+        /* Out of room, fold into whichever rectangle grows the least */
+        best = 0;
+        bestcost = -1;
+        for(i = 0; i < dpcomp->damagecount; i++) {
+            cost = _dprect_area(_dprect_union(r, dpcomp->damage[i])) - _dprect_area(dpcomp->damage[i]) - _dprect_area(r);
+            if(bestcost < 0 || cost < bestcost) {
+                bestcost = cost;
+                best = i;
+            }
+        }
+        r = _dprect_union(r, dpcomp->damage[best]);
+        dpcomp->damage[best] = dpcomp->damage[--dpcomp->damagecount];
+        _dpcomp_addDamage(dpcomp, r);
+        return;
+    }
+    dpcomp->damage[dpcomp->damagecount++] = r;
+}
+
+static void _dpcomp_sortLayers(dpCompositor *dpcomp) {
+    uint32_t i, j;
+    dpLayer *dplayer;
+    for(i = 1; i < dpcomp->layercount; i++) {
+        dplayer = dpcomp->layers[i];
+        for(j = i; j > 0 && dpcomp->layers[j - 1]->z > dplayer->z; j--)
+            dpcomp->layers[j] = dpcomp->layers[j - 1];
+        dpcomp->layers[j] = dplayer;
+    }
+}
+
+static void _dpcomp_composeRows(dpCompositor *dpcomp, const _dpRect r, const int32_t y0, const int32_t y1) {
+    dpBuffer *out = dpcomp->output;
+    dpLayer *dplayer;
+    dpPixel *row;
+    int32_t x, y, x0, x1, ly;
+    uint32_t i;
+    for(y = y0; y < y1; y++) {
+        row = out->pixels + (uint32_t)y * out->width;
+        for(x = r.x0; x < r.x1; x++)
+            row[x] = out->clearcolor;
+        for(i = 0; i < dpcomp->layercount; i++) {
+            dplayer = dpcomp->layers[i];
+            if(!dplayer->visible || dplayer->opacity == 0)
+                continue;
+            ly = y - dplayer->y;
+            if(ly < 0 || ly >= (int32_t)dplayer->buffer->height)
+                continue;
+            x0 = r.x0 > dplayer->x ? r.x0 : dplayer->x;
+            x1 = dplayer->x + (int32_t)dplayer->buffer->width;
+            x1 = r.x1 < x1 ? r.x1 : x1;
+            if(x0 >= x1)
+                continue;
+            _dp_blendSpan(row + x0, dplayer->buffer->pixels + (uint32_t)ly * dplayer->buffer->width + (uint32_t)(x0 - dplayer->x),
+                (uint32_t)(x1 - x0), dplayer->blendmode, dplayer->opacity);
+        }
+    }
+}
+
+static void _dpcomp_composeJob(void *data, const uint32_t job) {
+    _dpCompJob *cj = (_dpCompJob *)data;
+    int32_t y0 = cj->rect.y0 + (int32_t)job * cj->bandheight;
+    int32_t y1 = y0 + cj->bandheight;
+    _dpcomp_composeRows(cj->comp, cj->rect, y0, y1 < cj->rect.y1 ? y1 : cj->rect.y1);
+}
+
+dpCompositor *dpcomp_create(const uint32_t width, const uint32_t height) {
+    dpCompositor *dpcomp = malloc(sizeof(dpCompositor));
+    dpcomp->output = dpbuf_create(width, height);
+    dpcomp->layercount = 0;
+    dpcomp->damagecount = 0;
+    dpcomp->threads = 1;
+    return dpcomp;
+}
+
+dpLayer *dpcomp_addLayer(dpCompositor *dpcomp, const uint32_t width, const uint32_t height, const int32_t z) {
+    dpLayer *dplayer;
+    if(dpcomp->layercount == DP_MAX_LAYERS)
+        return NULL;
+    dplayer = malloc(sizeof(dpLayer));
+    dplayer->buffer = dpbuf_create(width, height);
+    dplayer->compositor = dpcomp;
+    dplayer->x = 0;
+    dplayer->y = 0;
+    dplayer->z = z;
+    dplayer->blendmode = DP_BLEND_ALPHA;
+    dplayer->opacity = 255;
+    dplayer->visible = 1;
+    dplayer->damaged = 0;
+    dpcomp->layers[dpcomp->layercount++] = dplayer;
+    _dpcomp_sortLayers(dpcomp);
+    dplayer_damageAll(dplayer);
+    return dplayer;
+}
+
+void dpcomp_removeLayer(dpCompositor *dpcomp, dpLayer *dplayer) {
+    uint32_t i;
+    for(i = 0; i < dpcomp->layercount; i++)
+        if(dpcomp->layers[i] == dplayer)
+            break;
+    if(i == dpcomp->layercount)
+        return;
+    for(; i + 1 < dpcomp->layercount; i++)
+        dpcomp->layers[i] = dpcomp->layers[i + 1]; /* <- Shift down to keep the z order */
+    dpcomp->layercount--;
+    _dpcomp_addDamage(dpcomp, _dplayer_screenRect(dplayer));
+    dpbuf_destroy(dplayer->buffer);
+    free(dplayer);
+}
+
+uint32_t dpcomp_composite(dpCompositor *dpcomp) {
+    _dpCompJob cj;
+    dpLayer *dplayer;
+    uint32_t i, pixels = 0, bands;
+    int64_t area;
+    for(i = 0; i < dpcomp->layercount; i++) {
+        dplayer = dpcomp->layers[i];
+        if(!dplayer->damaged)
+            continue;
+        _dpcomp_addDamage(dpcomp, _dprect_make(dplayer->x + dplayer->damage.x0, dplayer->y + dplayer->damage.y0,
+            dplayer->x + dplayer->damage.x1, dplayer->y + dplayer->damage.y1));
+        dplayer->damaged = 0;
+    }
+    for(i = 0; i < dpcomp->damagecount; i++) {
+        cj.comp = dpcomp;
+        cj.rect = dpcomp->damage[i];
+        area = _dprect_area(cj.rect);
+        pixels += (uint32_t)area;
+        if(dpcomp->threads > 1 && area >= DP_PARALLEL_MIN_PIXELS) {
+            bands = dpcomp->threads * 4; /* <- A few bands per thread evens out uneven layer coverage */
+            cj.bandheight = (cj.rect.y1 - cj.rect.y0 + (int32_t)bands - 1) / (int32_t)bands;
+            bands = (uint32_t)((cj.rect.y1 - cj.rect.y0 + cj.bandheight - 1) / cj.bandheight);
+            _dp_runJobs(_dpcomp_composeJob, &cj, bands, dpcomp->threads);
+        } else {
+            _dpcomp_composeRows(dpcomp, cj.rect, cj.rect.y0, cj.rect.y1);
+        }
+    }
+    dpcomp->damagecount = 0;
+    return pixels;
+}
+
+void dpcomp_damageAll(dpCompositor *dpcomp) {
+    _dpcomp_addDamage(dpcomp, _dprect_make(0, 0, dpcomp->output->width, dpcomp->output->height));
+}
+
+void dpcomp_setThreads(dpCompositor *dpcomp, const uint32_t threads) {
+    dpcomp->threads = threads == 0 ? 1 : threads;
+}
+
+dpBuffer *dpcomp_getBuffer(dpCompositor *dpcomp) {
+    return dpcomp->output;
+}
+
+void dpcomp_destroy(dpCompositor *dpcomp) {
+    uint32_t i;
+    for(i = 0; i < dpcomp->layercount; i++) {
+        dpbuf_destroy(dpcomp->layers[i]->buffer);
+        free(dpcomp->layers[i]);
+    }
+    dpbuf_destroy(dpcomp->output);
+    free(dpcomp);
+}
+
+
+/* Layer structure functions */
+
+void dplayer_damage(dpLayer *dplayer, const int32_t x, const int32_t y, const uint32_t width, const uint32_t height) {
+    _dpRect r = _dprect_intersect(_dprect_make(x, y, x + (int32_t)width, y + (int32_t)height),
+        _dprect_make(0, 0, dplayer->buffer->width, dplayer->buffer->height));
+    if(_dprect_isEmpty(r))
+        return;
+    dplayer->damage = dplayer->damaged ? _dprect_union(dplayer->damage, r) : r;
+    dplayer->damaged = 1;
+}
+
+void dplayer_damageAll(dpLayer *dplayer) {
+    dplayer_damage(dplayer, 0, 0, dplayer->buffer->width, dplayer->buffer->height);
+}
+
+void dplayer_setOffset(dpLayer *dplayer, const int32_t x, const int32_t y) {
+    if(dplayer->x == x && dplayer->y == y)
+        return;
+    _dpcomp_addDamage(dplayer->compositor, _dplayer_screenRect(dplayer)); /* <- Uncover where it was */
+    dplayer->x = x;
+    dplayer->y = y;
+    dplayer_damageAll(dplayer);
+}
+
+void dplayer_setZ(dpLayer *dplayer, const int32_t z) {
+    if(dplayer->z == z)
+        return;
+    dplayer->z = z;
+    _dpcomp_sortLayers(dplayer->compositor);
+    dplayer_damageAll(dplayer);
+}
+
+void dplayer_setOpacity(dpLayer *dplayer, const uint8_t opacity) {
+    if(dplayer->opacity == opacity)
+        return;
+    dplayer->opacity = opacity;
+    dplayer_damageAll(dplayer);
+}
+
+void dplayer_setBlendMode(dpLayer *dplayer, const int32_t blendmode) {
+    if(dplayer->blendmode == blendmode)
+        return;
+    dplayer->blendmode = blendmode;
+    dplayer_damageAll(dplayer);
+}
+
+void dplayer_setVisible(dpLayer *dplayer, const int32_t visible) {
+    if(!dplayer->visible == !visible)
+        return;
+    dplayer->visible = visible;
+    dplayer_damageAll(dplayer);
+}
+
+dpBuffer *dplayer_getBuffer(dpLayer *dplayer) {
+    return dplayer->buffer;
+}
+
+
+/* Filter structure functions */
+
+/*
+ *  Passes are grouped into stages when the filter is applied. A stage is a run of
+ *  horizontal or vertical blurs followed by any number of per-pixel passes, and the
+ *  per-pixel passes are done on the blurred rows while they are still in cache.
+ *  Row stages work on bands of rows, column stages on strips of DP_FILTER_STRIP
+ *  columns, so the only scratch memory is a couple of rows or strips per job.
+ */
+
+#define _DP_PASS_HBLUR     0
+#define _DP_PASS_VBLUR     1
+#define _DP_PASS_LUT1D     2
+#define _DP_PASS_LUT3D     3
+#define _DP_PASS_SCANLINES 4
+#define _DP_PASS_MASK      5
+#define _DP_PASS_QUANTIZE  6
+
+#define _DP_QUANTIZE_BITS 5 /* <- Per channel precision of the palette map */
+
+typedef struct _dpFilterJobStruct {
+    dpFilter *dpfilter;
+    dpBuffer *dpbuf;
+    uint32_t start; /* <- First pass of the stage */
+    uint32_t blurend; /* <- First per-pixel pass */
+    uint32_t end;
+} _dpFilterJob;
+
+static _dpFilterPass *_dpfilter_newPass(dpFilter *dpfilter, const int32_t type) {
+    _dpFilterPass *pass;
+    if(dpfilter->passcount == DP_MAX_FILTER_PASSES)
+        return NULL;
+    pass = &dpfilter->passes[dpfilter->passcount++];
+    memset(pass, 0, sizeof(_dpFilterPass));
+    pass->type = type;
+    return pass;
+}
+
+/*
+ *  Sliding window box blurs, edges are clamped. The radius is capped at 127 so a
+ *  window sum always fits in 16 bits, and dividing by the window is a multiply by
+ *  65536 / window rounded the same way in the scalar and SSE2 paths.
+ */
+#if defined(DP_SIMD_SSE2)
+static __m128i _dpfilter_divWindowx8(const __m128i sums, const __m128i inv) {
+    return _mm_add_epi16(_mm_mulhi_epu16(sums, inv), _mm_srli_epi16(_mm_mullo_epi16(sums, inv), 15));
+}
+
+static __m128i _dpfilter_loadPixel(const dpPixel *p) {
+    return _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)p->hex), _mm_setzero_si128());
+}
+#endif
+
+static void _dpfilter_boxRow(dpPixel *dst, const dpPixel *src, const int32_t n, const int32_t r) {
+    const uint32_t inv = 65536 / (uint32_t)(2 * r + 1);
+    int32_t x, i;
+#if defined(DP_SIMD_SSE2)
+    const __m128i vinv = _mm_set1_epi16((short)inv);
+    __m128i sums = _mm_setzero_si128(), out;
+    for(i = -r; i <= r; i++)
+        sums = _mm_add_epi16(sums, _dpfilter_loadPixel(src + (i < 0 ? 0 : (i >= n ? n - 1 : i))));
+    for(x = 0; x < n; x++) {
+        out = _dpfilter_divWindowx8(sums, vinv);
+        dst[x].hex = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(out, out));
+        sums = _mm_add_epi16(sums, _dpfilter_loadPixel(src + (x + r + 1 >= n ? n - 1 : x + r + 1)));
+        sums = _mm_sub_epi16(sums, _dpfilter_loadPixel(src + (x - r < 0 ? 0 : x - r)));
+    }
+#else
+    uint32_t sb = 0, sg = 0, sr = 0, sa = 0;
+    const dpPixel *in, *out;
+    for(i = -r; i <= r; i++) {
+        in = src + (i < 0 ? 0 : (i >= n ? n - 1 : i));
+        sb += in->b;
+        sg += in->g;
+        sr += in->r;
+        sa += in->a;
+    }
+    for(x = 0; x < n; x++) {
+        dst[x].b = (uint8_t)((sb * inv + 32768) >> 16);
+        dst[x].g = (uint8_t)((sg * inv + 32768) >> 16);
+        dst[x].r = (uint8_t)((sr * inv + 32768) >> 16);
+        dst[x].a = (uint8_t)((sa * inv + 32768) >> 16);
+        in = src + (x + r + 1 >= n ? n - 1 : x + r + 1);
+        out = src + (x - r < 0 ? 0 : x - r);
+        sb += in->b - out->b;
+        sg += in->g - out->g;
+        sr += in->r - out->r;
+        sa += in->a - out->a;
+    }
+#endif
+}
+
+/* Same as above but down a strip of columns at once, so every step works on whole runs of pixels */
+static void _dpfilter_boxStrip(dpPixel *dst, const uint32_t dststride, const dpPixel *src, const uint32_t srcstride, const uint32_t width, const int32_t n, const int32_t r) {
+    const uint32_t inv = 65536 / (uint32_t)(2 * r + 1);
+    const uint8_t *in, *out;
+    uint8_t *d;
+    int32_t y, i;
+    uint32_t c;
+#if defined(DP_SIMD_SSE2)
+    if(width == DP_FILTER_STRIP) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i vinv = _mm_set1_epi16((short)inv);
+        __m128i sums[DP_FILTER_STRIP / 2], v;
+        for(c = 0; c < DP_FILTER_STRIP / 2; c++)
+            sums[c] = zero;
+        for(i = -r; i <= r; i++) {
+            in = (const uint8_t *)(src + (uint32_t)(i < 0 ? 0 : (i >= n ? n - 1 : i)) * srcstride);
+            for(c = 0; c < DP_FILTER_STRIP / 4; c++) {
+                v = _mm_loadu_si128((const __m128i *)in + c);
+                sums[2 * c] = _mm_add_epi16(sums[2 * c], _mm_unpacklo_epi8(v, zero));
+                sums[2 * c + 1] = _mm_add_epi16(sums[2 * c + 1], _mm_unpackhi_epi8(v, zero));
+            }
+        }
+        for(y = 0; y < n; y++) {
+            d = (uint8_t *)(dst + (uint32_t)y * dststride);
+            in = (const uint8_t *)(src + (uint32_t)(y + r + 1 >= n ? n - 1 : y + r + 1) * srcstride);
+            out = (const uint8_t *)(src + (uint32_t)(y - r < 0 ? 0 : y - r) * srcstride);
+            for(c = 0; c < DP_FILTER_STRIP / 4; c++) {
+                _mm_storeu_si128((__m128i *)d + c, _mm_packus_epi16(_dpfilter_divWindowx8(sums[2 * c], vinv), _dpfilter_divWindowx8(sums[2 * c + 1], vinv)));
+                v = _mm_loadu_si128((const __m128i *)in + c);
+                sums[2 * c] = _mm_add_epi16(sums[2 * c], _mm_unpacklo_epi8(v, zero));
+                sums[2 * c + 1] = _mm_add_epi16(sums[2 * c + 1], _mm_unpackhi_epi8(v, zero));
+                v = _mm_loadu_si128((const __m128i *)out + c);
+                sums[2 * c] = _mm_sub_epi16(sums[2 * c], _mm_unpacklo_epi8(v, zero));
+                sums[2 * c + 1] = _mm_sub_epi16(sums[2 * c + 1], _mm_unpackhi_epi8(v, zero));
+            }
+        }
+        return;
+    }
+#endif
+    uint32_t sums[DP_FILTER_STRIP * 4];
+    memset(sums, 0, sizeof(sums));
+    for(i = -r; i <= r; i++) {
+        in = (const uint8_t *)(src + (uint32_t)(i < 0 ? 0 : (i >= n ? n - 1 : i)) * srcstride);
+        for(c = 0; c < width * 4; c++)
+            sums[c] += in[c];
+    }
+    for(y = 0; y < n; y++) {
+        d = (uint8_t *)(dst + (uint32_t)y * dststride);
+        for(c = 0; c < width * 4; c++)
+            d[c] = (uint8_t)((sums[c] * inv + 32768) >> 16);
+        in = (const uint8_t *)(src + (uint32_t)(y + r + 1 >= n ? n - 1 : y + r + 1) * srcstride);
+        out = (const uint8_t *)(src + (uint32_t)(y - r < 0 ? 0 : y - r) * srcstride);
+        for(c = 0; c < width * 4; c++)
+            sums[c] += in[c] - out[c];
+    }
+}
+
+/* Multiplies every channel of a span by amount / 255 */
+static void _dpfilter_scaleSpan(dpPixel *row, const uint32_t count, const uint32_t amount) {
+    uint32_t i = 0;
+#if defined(DP_SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i m = _mm_set1_epi16((short)amount);
+    __m128i p;
+    for(; i + 4 <= count; i += 4) {
+        p = _mm_loadu_si128((const __m128i *)(row + i));
+        p = _mm_packus_epi16(_dp_div255x8(_mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), m)),
+            _dp_div255x8(_mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), m)));
+        _mm_storeu_si128((__m128i *)(row + i), p);
+    }
+#endif
+    for(; i < count; i++) {
+        row[i].b = (uint8_t)DP_DIV255(row[i].b * amount);
+        row[i].g = (uint8_t)DP_DIV255(row[i].g * amount);
+        row[i].r = (uint8_t)DP_DIV255(row[i].r * amount);
+        row[i].a = (uint8_t)DP_DIV255(row[i].a * amount);
+    }
+}
+
+static uint8_t _dpfilter_lut3DChannel(const dpPixel *c, const uint32_t channel) {
+    return ((const uint8_t *)c)[channel];
+}
+
+/* Trilinear lookup, the table is indexed [b][g][r] with red changing fastest */
+static dpPixel _dpfilter_lut3D(const _dpFilterPass *pass, const dpPixel p) {
+    const uint32_t size = pass->param;
+    const uint32_t lr = pass->lookup[p.r], lg = pass->lookup[p.g], lb = pass->lookup[p.b];
+    const uint32_t ir = lr >> 8, ig = lg >> 8, ib = lb >> 8;
+    const uint32_t fr = lr & 0xFF, fg = lg & 0xFF, fb = lb & 0xFF;
+    const uint32_t sr = ir + 1 < size ? 1 : 0, sg = ig + 1 < size ? size : 0, sb = ib + 1 < size ? size * size : 0;
+    const dpPixel *c = pass->colors + (ib * size + ig) * size + ir;
+    dpPixel out = p;
+    uint32_t ch, c00, c01, c10, c11, c0, c1;
+    for(ch = 0; ch < 3; ch++) {
+        c00 = _dp_lerp8(_dpfilter_lut3DChannel(c, ch), _dpfilter_lut3DChannel(c + sr, ch), fr);
+        c01 = _dp_lerp8(_dpfilter_lut3DChannel(c + sg, ch), _dpfilter_lut3DChannel(c + sg + sr, ch), fr);
+        c10 = _dp_lerp8(_dpfilter_lut3DChannel(c + sb, ch), _dpfilter_lut3DChannel(c + sb + sr, ch), fr);
+        c11 = _dp_lerp8(_dpfilter_lut3DChannel(c + sb + sg, ch), _dpfilter_lut3DChannel(c + sb + sg + sr, ch), fr);
+        c0 = _dp_lerp8(c00, c01, fg);
+        c1 = _dp_lerp8(c10, c11, fg);
+        ((uint8_t *)&out)[ch] = _dp_lerp8(c0, c1, fb);
+    }
+    return out;
+}
+
+static void _dpfilter_pointwise(const _dpFilterPass *pass, dpPixel *row, const uint32_t count, const uint32_t x0, const uint32_t y) {
+    const uint32_t shift = 8 - _DP_QUANTIZE_BITS;
+    dpPixel p;
+    uint32_t i, phase;
+    switch(pass->type) {
+        case _DP_PASS_LUT1D:
+            for(i = 0; i < count; i++) {
+                row[i].b = pass->table[row[i].b];
+                row[i].g = pass->table[256 + row[i].g];
+                row[i].r = pass->table[512 + row[i].r];
+            }
+            break;
+        case _DP_PASS_LUT3D:
+            for(i = 0; i < count; i++)
+                row[i] = _dpfilter_lut3D(pass, row[i]);
+            break;
+        case _DP_PASS_SCANLINES:
+            if(y % pass->param == pass->param - 1)
+                _dpfilter_scaleSpan(row, count, pass->amount);
+            break;
+        case _DP_PASS_MASK:
+            /* Aperture grille, each column keeps one of red, green or blue at full strength */
+            phase = x0 % 3;
+            for(i = 0; i < count; i++) {
+                if(phase != 0)
+                    row[i].r = (uint8_t)DP_DIV255(row[i].r * pass->amount);
+                if(phase != 1)
+                    row[i].g = (uint8_t)DP_DIV255(row[i].g * pass->amount);
+                if(phase != 2)
+                    row[i].b = (uint8_t)DP_DIV255(row[i].b * pass->amount);
+                phase = phase == 2 ? 0 : phase + 1;
+            }
+            break;
+        case _DP_PASS_QUANTIZE:
+            for(i = 0; i < count; i++) {
+                p = pass->colors[pass->table[((row[i].r >> shift) << (2 * _DP_QUANTIZE_BITS)) | ((row[i].g >> shift) << _DP_QUANTIZE_BITS) | (row[i].b >> shift)]];
+                p.a = row[i].a;
+                row[i] = p;
+            }
+            break;
+    }
+}
+
+static void _dpfilter_rowJob(void *data, const uint32_t job) {
+    _dpFilterJob *fj = (_dpFilterJob *)data;
+    dpBuffer *dpbuf = fj->dpbuf;
+    dpPixel *scratch = NULL, *cur, *other, *tmp, *row;
+    uint32_t y, i, y1 = (job + 1) * DP_FILTER_BAND;
+    if(y1 > dpbuf->height)
+        y1 = dpbuf->height;
+    if(fj->blurend > fj->start)
+        scratch = malloc(sizeof(dpPixel) * dpbuf->width * 2);
+    for(y = job * DP_FILTER_BAND; y < y1; y++) {
+        row = dpbuf->pixels + y * dpbuf->width;
+        if(scratch != NULL) {
+            cur = scratch;
+            other = scratch + dpbuf->width;
+            memcpy(cur, row, sizeof(dpPixel) * dpbuf->width);
+            for(i = fj->start; i < fj->blurend; i++) {
+                _dpfilter_boxRow(i + 1 == fj->blurend ? row : other, cur, (int32_t)dpbuf->width, (int32_t)fj->dpfilter->passes[i].param);
+                tmp = cur;
+                cur = other;
+                other = tmp;
+            }
+        }
+        for(i = fj->blurend; i < fj->end; i++)
+            _dpfilter_pointwise(&fj->dpfilter->passes[i], row, dpbuf->width, 0, y);
+    }
+    free(scratch);
+}
+
+static void _dpfilter_columnJob(void *data, const uint32_t job) {
+    _dpFilterJob *fj = (_dpFilterJob *)data;
+    dpBuffer *dpbuf = fj->dpbuf;
+    dpPixel *scratch, *cur, *other, *tmp, *col;
+    uint32_t x0 = job * DP_FILTER_STRIP, width = DP_FILTER_STRIP, y, i;
+    if(x0 + width > dpbuf->width)
+        width = dpbuf->width - x0;
+    col = dpbuf->pixels + x0;
+    scratch = malloc(sizeof(dpPixel) * DP_FILTER_STRIP * dpbuf->height * 2);
+    cur = scratch;
+    other = scratch + DP_FILTER_STRIP * dpbuf->height;
+    for(y = 0; y < dpbuf->height; y++)
+        memcpy(cur + y * DP_FILTER_STRIP, col + y * dpbuf->width, sizeof(dpPixel) * width);
+    for(i = fj->start; i < fj->blurend; i++) {
+        if(i + 1 == fj->blurend)
+            _dpfilter_boxStrip(col, dpbuf->width, cur, DP_FILTER_STRIP, width, (int32_t)dpbuf->height, (int32_t)fj->dpfilter->passes[i].param);
+        else
+            _dpfilter_boxStrip(other, DP_FILTER_STRIP, cur, DP_FILTER_STRIP, width, (int32_t)dpbuf->height, (int32_t)fj->dpfilter->passes[i].param);
+        tmp = cur;
+        cur = other;
+        other = tmp;
+    }
+    free(scratch);
+    for(y = 0; y < dpbuf->height; y++)
+        for(i = fj->blurend; i < fj->end; i++)
+            _dpfilter_pointwise(&fj->dpfilter->passes[i], col + y * dpbuf->width, width, x0, y);
+}
+
+dpFilter *dpfilter_create() {
+    dpFilter *dpfilter = malloc(sizeof(dpFilter));
+    dpfilter->passcount = 0;
+    dpfilter->threads = 1;
+    return dpfilter;
+}
+
+int32_t dpfilter_addBoxBlur(dpFilter *dpfilter, const uint32_t radius) {
+    _dpFilterPass *pass;
+    if(radius == 0)
+        return 1;
+    if(dpfilter->passcount + 2 > DP_MAX_FILTER_PASSES)
+        return 0;
+    pass = _dpfilter_newPass(dpfilter, _DP_PASS_HBLUR);
+    pass->param = radius > DP_FILTER_MAX_RADIUS ? DP_FILTER_MAX_RADIUS : radius;
+    pass = _dpfilter_newPass(dpfilter, _DP_PASS_VBLUR);
+    pass->param = radius > DP_FILTER_MAX_RADIUS ? DP_FILTER_MAX_RADIUS : radius;
+    return 1;
+}
+
+int32_t dpfilter_addGaussianBlur(dpFilter *dpfilter, const float sigma) {
+    /*
+     *  Three box blurs in a row come within a few percent of a real Gaussian.
+     *  Box widths are picked so the combined variance matches sigma.
+     */
+    _dpFilterPass *pass;
+    uint32_t radii[3], i;
+    int32_t wl, m;
+    float ideal;
+    if(sigma <= 0.0f)
+        return 1;
+    if(dpfilter->passcount + 6 > DP_MAX_FILTER_PASSES)
+        return 0;
+    ideal = sqrtf(4.0f * sigma * sigma + 1.0f);
+    wl = (int32_t)ideal;
+    if(wl % 2 == 0)
+        wl--;
+    m = (int32_t)floorf((12.0f * sigma * sigma - 3.0f * wl * wl - 12.0f * wl - 9.0f) / (-4.0f * wl - 4.0f) + 0.5f);
+    for(i = 0; i < 3; i++) {
+        radii[i] = (uint32_t)(((int32_t)i < m ? wl : wl + 2) - 1) / 2;
+        if(radii[i] > DP_FILTER_MAX_RADIUS)
+            radii[i] = DP_FILTER_MAX_RADIUS;
+    }
+    /* Horizontal then vertical so each direction ends up fused into one stage */
+    for(i = 0; i < 6; i++) {
+        if(radii[i % 3] == 0)
+            continue;
+        pass = _dpfilter_newPass(dpfilter, i < 3 ? _DP_PASS_HBLUR : _DP_PASS_VBLUR);
+        pass->param = radii[i % 3];
+    }
+    return 1;
+}
+
+int32_t dpfilter_addLut1D(dpFilter *dpfilter, const uint8_t *red, const uint8_t *green, const uint8_t *blue) {
+    _dpFilterPass *pass = _dpfilter_newPass(dpfilter, _DP_PASS_LUT1D);
+    if(pass == NULL)
+        return 0;
+    pass->table = malloc(256 * 3);
+    memcpy(pass->table, blue, 256);
+    memcpy(pass->table + 256, green, 256);
+    memcpy(pass->table + 512, red, 256);
+    return 1;
+}
+
+int32_t dpfilter_addLut3D(dpFilter *dpfilter, const dpPixel *lut, const uint32_t size) {
+    _dpFilterPass *pass;
+    uint32_t i, pos;
+    if(size < 2 || size > 256)
+        return 0;
+    pass = _dpfilter_newPass(dpfilter, _DP_PASS_LUT3D);
+    if(pass == NULL)
+        return 0;
+    pass->param = size;
+    pass->colors = malloc(sizeof(dpPixel) * size * size * size);
+    memcpy(pass->colors, lut, sizeof(dpPixel) * size * size * size);
+    pass->lookup = malloc(sizeof(uint32_t) * 256);
+    for(i = 0; i < 256; i++) {
+        pos = i * (size - 1); /* <- Out of 255 */
+        pass->lookup[i] = ((pos / 255) << 8) | (pos % 255);
+    }
+    return 1;
+}
+
+int32_t dpfilter_addScanlines(dpFilter *dpfilter, const uint32_t period, const uint8_t darkness) {
+    _dpFilterPass *pass;
+    if(period == 0)
+        return 0;
+    pass = _dpfilter_newPass(dpfilter, _DP_PASS_SCANLINES);
+    if(pass == NULL)
+        return 0;
+    pass->param = period;
+    pass->amount = 255 - darkness;
+    return 1;
+}
+
+int32_t dpfilter_addMask(dpFilter *dpfilter, const uint8_t strength) {
+    _dpFilterPass *pass = _dpfilter_newPass(dpfilter, _DP_PASS_MASK);
+    if(pass == NULL)
+        return 0;
+    pass->amount = 255 - strength;
+    return 1;
+}
+
+int32_t dpfilter_addQuantize(dpFilter *dpfilter, const dpPixel *palette, const uint32_t count) {
+    const uint32_t cells = 1 << _DP_QUANTIZE_BITS, shift = 8 - _DP_QUANTIZE_BITS;
+    _dpFilterPass *pass;
+    uint32_t r, g, b, i, best, dist, bestdist;
+    int32_t dr, dg, db;
+    if(count == 0 || count > 256)
+        return 0;
+    pass = _dpfilter_newPass(dpfilter, _DP_PASS_QUANTIZE);
+    if(pass == NULL)
+        return 0;
+    pass->param = count;
+    pass->colors = malloc(sizeof(dpPixel) * count);
+    memcpy(pass->colors, palette, sizeof(dpPixel) * count);
+    /* Nearest palette entry for the center of every cell, so applying is a single lookup */
+    pass->table = malloc(cells * cells * cells);
+    for(r = 0; r < cells; r++) for(g = 0; g < cells; g++) for(b = 0; b < cells; b++) {
+        best = 0;
+        bestdist = 0xFFFFFFFF;
+        for(i = 0; i < count; i++) {
+            dr = (int32_t)((r << shift) | (1 << (shift - 1))) - palette[i].r;
+            dg = (int32_t)((g << shift) | (1 << (shift - 1))) - palette[i].g;
+            db = (int32_t)((b << shift) | (1 << (shift - 1))) - palette[i].b;
+            dist = (uint32_t)(dr * dr + dg * dg + db * db);
+            if(dist < bestdist) {
+                bestdist = dist;
+                best = i;
+            }
+        }
+        pass->table[(r << (2 * _DP_QUANTIZE_BITS)) | (g << _DP_QUANTIZE_BITS) | b] = (uint8_t)best;
+    }
+    return 1;
+}
+
+void dpfilter_setThreads(dpFilter *dpfilter, const uint32_t threads) {
+    dpfilter->threads = threads == 0 ? 1 : threads;
+}
+
+void dpfilter_apply(dpFilter *dpfilter, dpBuffer *dpbuf) {
+    _dpFilterJob fj;
+    uint32_t threads = dpbuf->length >= DP_PARALLEL_MIN_PIXELS ? dpfilter->threads : 1;
+    int32_t type;
+    if(dpbuf->length == 0)
+        return;
+    fj.dpfilter = dpfilter;
+    fj.dpbuf = dpbuf;
+    fj.start = 0;
+    while(fj.start < dpfilter->passcount) {
+        /* One stage: blurs of a single direction, then every per-pixel pass after them */
+        type = dpfilter->passes[fj.start].type;
+        for(fj.blurend = fj.start; fj.blurend < dpfilter->passcount && dpfilter->passes[fj.blurend].type == type
+            && (type == _DP_PASS_HBLUR || type == _DP_PASS_VBLUR); fj.blurend++);
+        for(fj.end = fj.blurend; fj.end < dpfilter->passcount && dpfilter->passes[fj.end].type != _DP_PASS_HBLUR
+            && dpfilter->passes[fj.end].type != _DP_PASS_VBLUR; fj.end++);
+        if(type == _DP_PASS_VBLUR)
+            _dp_runJobs(_dpfilter_columnJob, &fj, (dpbuf->width + DP_FILTER_STRIP - 1) / DP_FILTER_STRIP, threads);
+        else
+            _dp_runJobs(_dpfilter_rowJob, &fj, (dpbuf->height + DP_FILTER_BAND - 1) / DP_FILTER_BAND, threads);
+        fj.start = fj.end;
+    }
+}
+
+void dpfilter_destroy(dpFilter *dpfilter) {
+    uint32_t i;
+    for(i = 0; i < dpfilter->passcount; i++) {
+        free(dpfilter->passes[i].table);
+        free(dpfilter->passes[i].lookup);
+        free(dpfilter->passes[i].colors);
+    }
+    free(dpfilter);
+}
+
+
+/* Tilemap structure functions */
+
+static void _dptilemap_renderChunk(dpTilemap *dptilemap, const uint32_t cx, const uint32_t cy) {
+    _dpChunk *chunk = &dptilemap->chunks[cy * dptilemap->chunksx + cx];
+    uint32_t tx, ty, mx, my;
+    uint16_t tile;
+    for(ty = 0; ty < DP_TILEMAP_CHUNK; ty++) {
+        my = cy * DP_TILEMAP_CHUNK + ty;
+        for(tx = 0; tx < DP_TILEMAP_CHUNK; tx++) {
+            mx = cx * DP_TILEMAP_CHUNK + tx;
+            tile = mx < dptilemap->width && my < dptilemap->height ? dptilemap->tiles[my * dptilemap->width + mx] : DP_TILE_EMPTY;
+            if(tile >= dptilemap->tilecount)
+                dpbuf_fill(chunk->buffer, (int32_t)(tx * dptilemap->tilewidth), (int32_t)(ty * dptilemap->tileheight),
+                    dptilemap->tilewidth, dptilemap->tileheight, dptilemap->clearcolor);
+            else
+                dpbuf_blit(chunk->buffer, dptilemap->tileset, (int32_t)(tx * dptilemap->tilewidth), (int32_t)(ty * dptilemap->tileheight),
+                    (int32_t)((tile % dptilemap->tilesetcolumns) * dptilemap->tilewidth), (int32_t)((tile / dptilemap->tilesetcolumns) * dptilemap->tileheight),
+                    dptilemap->tilewidth, dptilemap->tileheight);
+        }
+    }
+    chunk->dirty = 0;
+}
+
+/* Gives the chunk a buffer, taking the least recently drawn one if the cache is full */
+static void _dptilemap_cacheChunk(dpTilemap *dptilemap, _dpChunk *chunk) {
+    _dpChunk *oldest = NULL;
+    uint32_t i;
+    if(dptilemap->cached >= dptilemap->cachesize) {
+        for(i = 0; i < dptilemap->chunksx * dptilemap->chunksy; i++) {
+            if(dptilemap->chunks[i].buffer == NULL || dptilemap->chunks[i].lastused == dptilemap->frame)
+                continue; /* <- Never evict something already drawn this frame */
+            if(oldest == NULL || dptilemap->chunks[i].lastused < oldest->lastused)
+                oldest = &dptilemap->chunks[i];
+        }
+    }
+    if(oldest != NULL) {
+        chunk->buffer = oldest->buffer;
+        oldest->buffer = NULL;
+    } else {
+        chunk->buffer = dpbuf_create(DP_TILEMAP_CHUNK * dptilemap->tilewidth, DP_TILEMAP_CHUNK * dptilemap->tileheight);
+        dptilemap->cached++;
+    }
+    chunk->dirty = 1;
+}
+
+dpTilemap *dptilemap_create(const uint32_t width, const uint32_t height, dpBuffer *tileset, const uint32_t tilewidth, const uint32_t tileheight) {
+    dpTilemap *dptilemap = malloc(sizeof(dpTilemap));
+    uint32_t i;
+    dptilemap->width = width;
+    dptilemap->height = height;
+    dptilemap->tiles = malloc(sizeof(uint16_t) * width * height);
+    for(i = 0; i < width * height; i++)
+        dptilemap->tiles[i] = DP_TILE_EMPTY;
+    dptilemap->tileset = tileset;
+    dptilemap->tilewidth = tilewidth;
+    dptilemap->tileheight = tileheight;
+    dptilemap->tilesetcolumns = tileset->width / tilewidth;
+    dptilemap->tilecount = dptilemap->tilesetcolumns * (tileset->height / tileheight);
+    dptilemap->clearcolor = dppix_hex(0x0);
+    dptilemap->chunksx = (width + DP_TILEMAP_CHUNK - 1) / DP_TILEMAP_CHUNK;
+    dptilemap->chunksy = (height + DP_TILEMAP_CHUNK - 1) / DP_TILEMAP_CHUNK;
+    dptilemap->chunks = malloc(sizeof(_dpChunk) * dptilemap->chunksx * dptilemap->chunksy);
+    for(i = 0; i < dptilemap->chunksx * dptilemap->chunksy; i++) {
+        dptilemap->chunks[i].buffer = NULL;
+        dptilemap->chunks[i].dirty = 1;
+        dptilemap->chunks[i].lastused = 0;
+    }
+    dptilemap->cached = 0;
+    dptilemap->cachesize = DP_TILEMAP_CACHE;
+    dptilemap->frame = 0;
+    return dptilemap;
+}
+
+void dptilemap_setTile(dpTilemap *dptilemap, const uint32_t x, const uint32_t y, const uint16_t tile) {
+    uint16_t *t;
+    if(x >= dptilemap->width || y >= dptilemap->height)
+        return;
+    t = &dptilemap->tiles[y * dptilemap->width + x];
+    if(*t == tile)
+        return;
+    *t = tile;
+    dptilemap->chunks[(y / DP_TILEMAP_CHUNK) * dptilemap->chunksx + x / DP_TILEMAP_CHUNK].dirty = 1;
+}
+
+void dptilemap_setTiles(dpTilemap *dptilemap, const uint16_t *tiles) {
+    uint32_t x, y;
+    for(y = 0; y < dptilemap->height; y++)
+        for(x = 0; x < dptilemap->width; x++)
+            dptilemap_setTile(dptilemap, x, y, tiles[y * dptilemap->width + x]);
+}
+
+uint16_t dptilemap_getTile(dpTilemap *dptilemap, const uint32_t x, const uint32_t y) {
+    if(x >= dptilemap->width || y >= dptilemap->height)
+        return DP_TILE_EMPTY;
+    return dptilemap->tiles[y * dptilemap->width + x];
+}
+
+void dptilemap_setClearColor(dpTilemap *dptilemap, const dpPixel pixel) {
+    if(dptilemap->clearcolor.hex == pixel.hex)
+        return;
+    dptilemap->clearcolor = pixel;
+    dptilemap_invalidate(dptilemap);
+}
+
+void dptilemap_setCacheSize(dpTilemap *dptilemap, const uint32_t chunks) {
+    dptilemap->cachesize = chunks;
+}
+
+void dptilemap_invalidate(dpTilemap *dptilemap) {
+    uint32_t i;
+    for(i = 0; i < dptilemap->chunksx * dptilemap->chunksy; i++)
+        dptilemap->chunks[i].dirty = 1;
+}
+
+/* Draws the map into the whole buffer with (camerax, cameray) in map pixels at its top left */
+void dptilemap_draw(dpTilemap *dptilemap, dpBuffer *dpbuf, const int32_t camerax, const int32_t cameray) {
+    const int32_t chunkwidth = (int32_t)(DP_TILEMAP_CHUNK * dptilemap->tilewidth);
+    const int32_t chunkheight = (int32_t)(DP_TILEMAP_CHUNK * dptilemap->tileheight);
+    const _dpRect view = _dprect_make(camerax, cameray, camerax + (int32_t)dpbuf->width, cameray + (int32_t)dpbuf->height);
+    const _dpRect map = _dprect_make(0, 0, (int32_t)(dptilemap->width * dptilemap->tilewidth), (int32_t)(dptilemap->height * dptilemap->tileheight));
+    const _dpRect visible = _dprect_intersect(view, map);
+    _dpChunk *chunk;
+    _dpRect area;
+    int32_t cx, cy;
+    dptilemap->frame++;
+    if(_dprect_area(visible) != _dprect_area(view))
+        dpbuf_clear(dpbuf); /* <- Part of the view is off the map */
+    if(_dprect_isEmpty(visible))
+        return;
+    for(cy = visible.y0 / chunkheight; cy <= (visible.y1 - 1) / chunkheight; cy++) {
+        for(cx = visible.x0 / chunkwidth; cx <= (visible.x1 - 1) / chunkwidth; cx++) {
+            chunk = &dptilemap->chunks[(uint32_t)cy * dptilemap->chunksx + (uint32_t)cx];
+            if(chunk->buffer == NULL)
+                _dptilemap_cacheChunk(dptilemap, chunk);
+            if(chunk->dirty)
+                _dptilemap_renderChunk(dptilemap, (uint32_t)cx, (uint32_t)cy);
+            chunk->lastused = dptilemap->frame;
+            area = _dprect_intersect(visible, _dprect_make(cx * chunkwidth, cy * chunkheight, (cx + 1) * chunkwidth, (cy + 1) * chunkheight));
+            dpbuf_blit(dpbuf, chunk->buffer, area.x0 - camerax, area.y0 - cameray, area.x0 - cx * chunkwidth, area.y0 - cy * chunkheight,
+                (uint32_t)(area.x1 - area.x0), (uint32_t)(area.y1 - area.y0));
+        }
+    }
+}
+
+void dptilemap_destroy(dpTilemap *dptilemap) {
+    uint32_t i;
+    for(i = 0; i < dptilemap->chunksx * dptilemap->chunksy; i++)
+        if(dptilemap->chunks[i].buffer != NULL)
+            dpbuf_destroy(dptilemap->chunks[i].buffer);
+    free(dptilemap->chunks);
+    free(dptilemap->tiles);
+    free(dptilemap);
+}
+
+
+/* Recorder structure functions */
+
+/*
+ *  Stream layout, every value is a little endian 32 bit word:
+ *      header:   magic, version
+ *      command:  type, then its words
+ *      BUFFER    id, width, height
+ *      SNAPSHOT  id, then width * height pixels
+ *      CLEAR     id, color
+ *      PIXELS    id, count, then count * (x, y, pixel)
+ *      FILL      id, x, y, width, height, color, blend mode
+ *      BLIT      dst id, src id, dx, dy, sx, sy, width, height
+ *      INPUT     mouse x, mouse y, count, then count * (code, state) for keys and
+ *                buttons that changed, buttons are numbered after DP_MAX_KEYS
+ *      FRAME     id
+ *  putPixel calls are gathered in memory and written as one PIXELS command when
+ *  anything else is recorded or DP_RECORD_BATCH of them are waiting.
+ */
+
+typedef struct dpRecorderStruct {
+    FILE *file;
+    dpBuffer **buffers; /* <- Indexed by record id, NULL once destroyed */
+    uint32_t buffercount;
+    uint32_t buffercapacity;
+    dpWindow *window;
+    int32_t keys[DP_MAX_KEYS];
+    int32_t buttons[DP_MAX_BUTTONS];
+    int32_t mousex;
+    int32_t mousey;
+    uint32_t batchid;
+    uint32_t batchcount;
+    uint32_t batch[DP_RECORD_BATCH * 3];
+} dpRecorder;
+
+static double _dp_seconds() {
+#if defined(DP_BUILD_WINDOWS)
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#elif defined(DP_BUILD_LINUX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static uint64_t _dp_hashPixels(const dpBuffer *dpbuf) {
+    uint64_t hash = 14695981039346656037ULL; /* <- FNV-1a, one pixel at a time */
+    uint32_t i;
+    for(i = 0; i < dpbuf->length; i++) {
+        hash ^= dpbuf->pixels[i].hex;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void _dprec_write(dpRecorder *dprec, const uint32_t *words, const uint32_t count) {
+    uint8_t bytes[64];
+    uint32_t i, n;
+    for(i = 0; i < count; i += n) {
+        for(n = 0; n < 16 && i + n < count; n++) {
+            bytes[n * 4 + 0] = (uint8_t)(words[i + n]);
+            bytes[n * 4 + 1] = (uint8_t)(words[i + n] >> 8);
+            bytes[n * 4 + 2] = (uint8_t)(words[i + n] >> 16);
+            bytes[n * 4 + 3] = (uint8_t)(words[i + n] >> 24);
+        }
+        fwrite(bytes, 4, n, dprec->file);
+    }
+}
+
+static void _dprec_flushPixels(dpRecorder *dprec) {
+    uint32_t header[3] = { DP_CMD_PIXELS, dprec->batchid, dprec->batchcount };
+    if(dprec->batchcount == 0)
+        return;
+    _dprec_write(dprec, header, 3);
+    _dprec_write(dprec, dprec->batch, dprec->batchcount * 3);
+    dprec->batchcount = 0;
+}
+
+/* Every command other than PIXELS starts here so batched pixels stay in order */
+static void _dprec_command(dpRecorder *dprec, const uint32_t *words, const uint32_t count) {
+    _dprec_flushPixels(dprec);
+    _dprec_write(dprec, words, count);
+}
+
+static void _dprec_pixel(dpRecorder *dprec, dpBuffer *dpbuf, const int32_t x, const int32_t y, const dpPixel pixel) {
+    if(dprec->batchcount == DP_RECORD_BATCH || (dprec->batchcount > 0 && dprec->batchid != dpbuf->recordid))
+        _dprec_flushPixels(dprec);
+    dprec->batchid = dpbuf->recordid;
+    dprec->batch[dprec->batchcount * 3 + 0] = (uint32_t)x;
+    dprec->batch[dprec->batchcount * 3 + 1] = (uint32_t)y;
+    dprec->batch[dprec->batchcount * 3 + 2] = pixel.hex;
+    dprec->batchcount++;
+}
+
+static void _dprec_clear(dpRecorder *dprec, dpBuffer *dpbuf) {
+    uint32_t words[3] = { DP_CMD_CLEAR, dpbuf->recordid, dpbuf->clearcolor.hex };
+    _dprec_command(dprec, words, 3);
+}
+
+static void _dprec_fill(dpRecorder *dprec, dpBuffer *dpbuf, const int32_t x, const int32_t y, const int32_t width, const int32_t height, const dpPixel color, const int32_t blendmode) {
+    uint32_t words[8] = { DP_CMD_FILL, dpbuf->recordid, (uint32_t)x, (uint32_t)y, (uint32_t)width, (uint32_t)height, color.hex, (uint32_t)blendmode };
+    _dprec_command(dprec, words, 8);
+}
+
+static void _dprec_blit(dpRecorder *dprec, dpBuffer *dst, dpBuffer *src, const int32_t dx, const int32_t dy, const int32_t sx, const int32_t sy, const uint32_t width, const uint32_t height) {
+    uint32_t words[9] = { DP_CMD_BLIT, dst->recordid, src->recordid, (uint32_t)dx, (uint32_t)dy, (uint32_t)sx, (uint32_t)sy, width, height };
+    _dprec_command(dprec, words, 9);
+}
+
+static void _dprec_input(dpRecorder *dprec, dpWindow *dpwin) {
+    uint32_t words[3] = { DP_CMD_INPUT, (uint32_t)dpwin->mousex, (uint32_t)dpwin->mousey };
+    uint32_t change[2], count = 0, i;
+    if(dpwin != dprec->window)
+        return;
+    for(i = 0; i < DP_MAX_KEYS; i++)
+        count += dpwin->keys[i] != dprec->keys[i];
+    for(i = 0; i < DP_MAX_BUTTONS; i++)
+        count += dpwin->buttons[i] != dprec->buttons[i];
+    _dprec_command(dprec, words, 3);
+    _dprec_write(dprec, &count, 1);
+    for(i = 0; i < DP_MAX_KEYS + DP_MAX_BUTTONS; i++) {
+        change[0] = i;
+        change[1] = (uint32_t)(i < DP_MAX_KEYS ? dpwin->keys[i] : dpwin->buttons[i - DP_MAX_KEYS]);
+        if((int32_t)change[1] == (i < DP_MAX_KEYS ? dprec->keys[i] : dprec->buttons[i - DP_MAX_KEYS]))
+            continue;
+        _dprec_write(dprec, change, 2);
+    }
+    memcpy(dprec->keys, dpwin->keys, sizeof(dprec->keys));
+    memcpy(dprec->buttons, dpwin->buttons, sizeof(dprec->buttons));
+    dprec->mousex = dpwin->mousex;
+    dprec->mousey = dpwin->mousey;
+}
+
+static void _dprec_frame(dpRecorder *dprec, dpBuffer *dpbuf) {
+    uint32_t words[2] = { DP_CMD_FRAME, dpbuf->recordid };
+    _dprec_command(dprec, words, 2);
+}
+
+static void _dprec_detachBuffer(dpRecorder *dprec, dpBuffer *dpbuf) {
+    if(dprec->batchcount > 0 && dprec->batchid == dpbuf->recordid)
+        _dprec_flushPixels(dprec);
+    dprec->buffers[dpbuf->recordid] = NULL;
+    dpbuf->recorder = NULL;
+}
+
+/* Fill with any blend mode, shared by dpbuf_fill, graphics contexts and replays */
+static void _dpbuf_fill(dpBuffer *dpbuf, const int32_t x, const int32_t y, const int32_t width, const int32_t height, const dpPixel color, const int32_t blendmode) {
+    const _dpRect r = _dprect_intersect(_dprect_make(x, y, x + width, y + height), _dprect_make(0, 0, dpbuf->width, dpbuf->height));
+    dpPixel *row;
+    int32_t i, j;
+    if(_dprect_isEmpty(r))
+        return;
+    if(dpbuf->recorder != NULL)
+        _dprec_fill(dpbuf->recorder, dpbuf, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, color, blendmode);
+    for(j = r.y0; j < r.y1; j++) {
+        row = dpbuf->pixels + (uint32_t)j * dpbuf->width;
+        if(blendmode == DP_BLEND_COPY) {
+            for(i = r.x0; i < r.x1; i++)
+                row[i] = color;
+        } else {
+            for(i = r.x0; i < r.x1; i++)
+                row[i] = _dp_blendPixel(row[i], color, blendmode, 255);
+        }
+    }
+}
+
+dpRecorder *dprec_create(const char *path) {
+    uint32_t header[2] = { DP_RECORD_MAGIC, DP_RECORD_VERSION };
+    dpRecorder *dprec = malloc(sizeof(dpRecorder));
+    dprec->file = fopen(path, "wb");
+    if(dprec->file == NULL) {
+        free(dprec);
+        return NULL;
+    }
+    setvbuf(dprec->file, NULL, _IOFBF, 1 << 16);
+    dprec->buffers = NULL;
+    dprec->buffercount = 0;
+    dprec->buffercapacity = 0;
+    dprec->window = NULL;
+    dprec->batchid = 0;
+    dprec->batchcount = 0;
+    _dprec_write(dprec, header, 2);
+    return dprec;
+}
+
+void dprec_attachBuffer(dpRecorder *dprec, dpBuffer *dpbuf) {
+    uint32_t words[4];
+    if(dpbuf->recorder == dprec)
+        return;
+    if(dpbuf->recorder != NULL)
+        _dprec_detachBuffer(dpbuf->recorder, dpbuf);
+    if(dprec->buffercount == dprec->buffercapacity) {
+        dprec->buffercapacity = dprec->buffercapacity ? dprec->buffercapacity * 2 : 16;
+        dprec->buffers = realloc(dprec->buffers, sizeof(dpBuffer *) * dprec->buffercapacity);
+    }
+    dpbuf->recorder = dprec;
+    dpbuf->recordid = dprec->buffercount;
+    dprec->buffers[dprec->buffercount++] = dpbuf;
+    words[0] = DP_CMD_BUFFER;
+    words[1] = dpbuf->recordid;
+    words[2] = dpbuf->width;
+    words[3] = dpbuf->height;
+    _dprec_command(dprec, words, 4);
+    dprec_snapshot(dprec, dpbuf);
+}
+
+void dprec_attachWindow(dpRecorder *dprec, dpWindow *dpwin) {
+    if(dprec->window != NULL)
+        dprec->window->recorder = NULL;
+    dprec->window = dpwin;
+    if(dpwin == NULL)
+        return;
+    dpwin->recorder = dprec;
+    /* Start from nothing held so the first tick records the full state */
+    memset(dprec->keys, 0, sizeof(dprec->keys));
+    memset(dprec->buttons, 0, sizeof(dprec->buttons));
+}
+
+void dprec_snapshot(dpRecorder *dprec, dpBuffer *dpbuf) {
+    uint32_t words[2] = { DP_CMD_SNAPSHOT, dpbuf->recordid };
+    if(dpbuf->recorder != dprec)
+        return;
+    _dprec_command(dprec, words, 2);
+    _dprec_write(dprec, (const uint32_t *)dpbuf->pixels, dpbuf->length);
+}
+
+void dprec_flush(dpRecorder *dprec) {
+    _dprec_flushPixels(dprec);
+    fflush(dprec->file);
+}
+
+void dprec_destroy(dpRecorder *dprec) {
+    uint32_t i;
+    _dprec_flushPixels(dprec);
+    for(i = 0; i < dprec->buffercount; i++)
+        if(dprec->buffers[i] != NULL)
+            dprec->buffers[i]->recorder = NULL;
+    if(dprec->window != NULL)
+        dprec->window->recorder = NULL;
+    fclose(dprec->file);
+    free(dprec->buffers);
+    free(dprec);
+}
+
+/* Replay reads the whole stream up front so the timings only cover drawing */
+static int32_t _dprec_read(const uint8_t *data, const size_t size, size_t *pos, uint32_t *words, const uint32_t count) {
+    uint32_t i;
+    if(size - *pos < (size_t)count * 4)
+        return 0;
+    for(i = 0; i < count; i++, *pos += 4)
+        words[i] = (uint32_t)data[*pos] | ((uint32_t)data[*pos + 1] << 8) | ((uint32_t)data[*pos + 2] << 16) | ((uint32_t)data[*pos + 3] << 24);
+    return 1;
+}
+
+int32_t dprec_replay(const char *path, dpReplayStats *stats) {
+    FILE *file = fopen(path, "rb");
+    dpBuffer **buffers = NULL, *dpbuf;
+    uint8_t *data;
+    size_t size, pos = 0;
+    uint32_t w[9], buffercount = 0, i, n, type;
+    int32_t ok = 1;
+    double start;
+    memset(stats, 0, sizeof(dpReplayStats));
+    stats->streamhash = 14695981039346656037ULL;
+    if(file == NULL)
+        return 0;
+    fseek(file, 0, SEEK_END);
+    size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = malloc(size ? size : 1);
+    if(fread(data, 1, size, file) != size)
+        size = 0;
+    fclose(file);
+    if(!_dprec_read(data, size, &pos, w, 2) || w[0] != DP_RECORD_MAGIC || w[1] != DP_RECORD_VERSION) {
+        free(data);
+        return 0;
+    }
+    while(ok && pos < size) {
+        if(!_dprec_read(data, size, &pos, &type, 1) || type >= DP_CMD_COUNT) {
+            ok = 0;
+            break;
+        }
+        start = _dp_seconds();
+        switch(type) {
+            case DP_CMD_BUFFER:
+                if(!(ok = _dprec_read(data, size, &pos, w, 3)) || w[0] != buffercount) {
+                    ok = 0;
+                    break;
+                }
+                buffers = realloc(buffers, sizeof(dpBuffer *) * ++buffercount);
+                buffers[w[0]] = dpbuf_create(w[1], w[2]);
+                break;
+            case DP_CMD_SNAPSHOT:
+                if(!(ok = _dprec_read(data, size, &pos, w, 1) && w[0] < buffercount))
+                    break;
+                dpbuf = buffers[w[0]];
+                if(!(ok = size - pos >= (size_t)dpbuf->length * 4))
+                    break;
+                for(i = 0; i < dpbuf->length; i++)
+                    _dprec_read(data, size, &pos, &dpbuf->pixels[i].hex, 1);
+                break;
+            case DP_CMD_CLEAR:
+                if(!(ok = _dprec_read(data, size, &pos, w, 2) && w[0] < buffercount))
+                    break;
+                dpbuf_setClearColor(buffers[w[0]], dppix_hex(w[1]));
+                dpbuf_clear(buffers[w[0]]);
+                break;
+            case DP_CMD_PIXELS:
+                if(!(ok = _dprec_read(data, size, &pos, w, 2) && w[0] < buffercount && size - pos >= (size_t)w[1] * 12))
+                    break;
+                dpbuf = buffers[w[0]];
+                for(i = 0, n = w[1]; i < n; i++) {
+                    _dprec_read(data, size, &pos, w, 3);
+                    dpbuf_putPixel(dpbuf, (int32_t)w[0], (int32_t)w[1], dppix_hex(w[2]));
+                }
+                break;
+            case DP_CMD_FILL:
+                if(!(ok = _dprec_read(data, size, &pos, w, 7) && w[0] < buffercount))
+                    break;
+                _dpbuf_fill(buffers[w[0]], (int32_t)w[1], (int32_t)w[2], (int32_t)w[3], (int32_t)w[4], dppix_hex(w[5]), (int32_t)w[6]);
+                break;
+            case DP_CMD_BLIT:
+                if(!(ok = _dprec_read(data, size, &pos, w, 8) && w[0] < buffercount && w[1] < buffercount))
+                    break;
+                dpbuf_blit(buffers[w[0]], buffers[w[1]], (int32_t)w[2], (int32_t)w[3], (int32_t)w[4], (int32_t)w[5], w[6], w[7]);
+                break;
+            case DP_CMD_INPUT:
+                /* Nothing to do without a window, but the stream still has to be walked */
+                if(!(ok = _dprec_read(data, size, &pos, w, 3) && size - pos >= (size_t)w[2] * 8))
+                    break;
+                pos += (size_t)w[2] * 8;
+                break;
+            case DP_CMD_FRAME:
+                if(!(ok = _dprec_read(data, size, &pos, w, 1) && w[0] < buffercount))
+                    break;
+                stats->framehash = _dp_hashPixels(buffers[w[0]]);
+                stats->streamhash = (stats->streamhash ^ stats->framehash) * 1099511628211ULL;
+                stats->frames++;
+                break;
+        }
+        stats->seconds[type] += _dp_seconds() - start;
+        stats->counts[type]++;
+    }
+    for(i = 0; i < buffercount; i++)
+        dpbuf_destroy(buffers[i]);
+    free(buffers);
+    free(data);
+    return ok;
+}
+
+
 /* Vector 2 fuctions */
 
 dpVec2 dpvec2_add(const dpVec2 a, const dpVec2 b) {
@@ -411,8 +2084,8 @@ float dpvec3_dot(const dpVec3 a, const dpVec3 b) {
 dpVec3 dpvec3_cross(const dpVec3 a, const dpVec3 b) {
     dpVec3 v = {
         a.y * b.z - a.z * b.y,
-        a.z * b.x - a.x - b.z,
-        a.x * b.y - a.y - b.x
+        a.z * b.x - a.x * b.z,
+        a.x * b.y - a.y * b.x
     };
     return v;
 }
@@ -504,16 +2177,737 @@ dpMat3 dpmat3_mult(const dpMat3 a, const dpMat3 b) {
     return m;
 }
 
+dpMat4 dpmat4_identity() {
+    dpMat4 m = { {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    } };
+    return m;
+}
+
+dpMat4 dpmat4_translate(const float tx, const float ty, const float tz) {
+    dpMat4 m = { {
+        1.0f, 0.0f, 0.0f,   tx,
+        0.0f, 1.0f, 0.0f,   ty,
+        0.0f, 0.0f, 1.0f,   tz,
+        0.0f, 0.0f, 0.0f, 1.0f
+    } };
+    return m;
+}
+
+dpMat4 dpmat4_scale(const float sx, const float sy, const float sz) {
+    dpMat4 m = { {
+          sx, 0.0f, 0.0f, 0.0f,
+        0.0f,   sy, 0.0f, 0.0f,
+        0.0f, 0.0f,   sz, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    } };
+    return m;
+}
+
+dpMat4 dpmat4_rotateX(const float r) {
+    dpMat4 m = dpmat4_identity();
+    m.e[5] = cosf(r);
+    m.e[6] = -sinf(r);
+    m.e[9] = -m.e[6];
+    m.e[10] = m.e[5];
+    return m;
+}
+
+dpMat4 dpmat4_rotateY(const float r) {
+    dpMat4 m = dpmat4_identity();
+    m.e[0] = cosf(r);
+    m.e[2] = sinf(r);
+    m.e[8] = -m.e[2];
+    m.e[10] = m.e[0];
+    return m;
+}
+
+dpMat4 dpmat4_rotateZ(const float r) {
+    dpMat4 m = dpmat4_identity();
+    m.e[0] = cosf(r);
+    m.e[1] = -sinf(r);
+    m.e[4] = -m.e[1];
+    m.e[5] = m.e[0];
+    return m;
+}
+
+/* OpenGL style, looking down -z with depth from -1 at near to 1 at far */
+dpMat4 dpmat4_perspective(const float fovy, const float aspect, const float znear, const float zfar) {
+    float f = 1.0f / tanf(fovy * 0.5f);
+    dpMat4 m = { {
+        f / aspect, 0.0f, 0.0f, 0.0f,
+        0.0f, f, 0.0f, 0.0f,
+        0.0f, 0.0f, (zfar + znear) / (znear - zfar), 2.0f * zfar * znear / (znear - zfar),
+        0.0f, 0.0f, -1.0f, 0.0f
+    } };
+    return m;
+}
+
+dpMat4 dpmat4_lookAt(const dpVec3 eye, const dpVec3 target, const dpVec3 up) {
+    dpVec3 f = dpvec3_normalize(dpvec3_sub(target, eye));
+    dpVec3 s = dpvec3_normalize(dpvec3_cross(f, up));
+    dpVec3 u = dpvec3_cross(s, f);
+    dpMat4 m = { {
+         s.x,  s.y,  s.z, -dpvec3_dot(s, eye),
+         u.x,  u.y,  u.z, -dpvec3_dot(u, eye),
+        -f.x, -f.y, -f.z,  dpvec3_dot(f, eye),
+        0.0f, 0.0f, 0.0f, 1.0f
+    } };
+    return m;
+}
+
+dpMat4 dpmat4_mult(const dpMat4 a, const dpMat4 b) {
+    dpMat4 m;
+    uint32_t row, col;
+    for(row = 0; row < 4; row++)
+        for(col = 0; col < 4; col++)
+            m.e[row * 4 + col] =
+                a.e[row * 4 + 0] * b.e[0 * 4 + col] +
+                a.e[row * 4 + 1] * b.e[1 * 4 + col] +
+                a.e[row * 4 + 2] * b.e[2 * 4 + col] +
+                a.e[row * 4 + 3] * b.e[3 * 4 + col];
+    return m;
+}
+
+dpVec4 dpmat4_transform(const dpMat4 m, const dpVec4 v) {
+    dpVec4 r = {
+        m.e[0] * v.x + m.e[1] * v.y + m.e[2] * v.z + m.e[3] * v.w,
+        m.e[4] * v.x + m.e[5] * v.y + m.e[6] * v.z + m.e[7] * v.w,
+        m.e[8] * v.x + m.e[9] * v.y + m.e[10] * v.z + m.e[11] * v.w,
+        m.e[12] * v.x + m.e[13] * v.y + m.e[14] * v.z + m.e[15] * v.w
+    };
+    return r;
+}
+
+
+/* Raster structure functions */
+
+/*
+ *  Triangles go through three steps. First every triangle is transformed, lit, clipped
+ *  against the view frustum in homogeneous space and set up as edge functions plus
+ *  depth and color planes. Then each one is binned into the DP_RASTER_TILE sized tiles
+ *  its bounds touch. Last, each tile (a job for the worker threads) walks its bin in
+ *  submission order, so the result is the same no matter how many threads are used.
+ *  Each tile also keeps the farthest depth it can contain. A triangle whose nearest
+ *  point is behind that is skipped for the whole tile without touching a pixel.
+ */
+
+typedef struct _dpClipVertexStruct {
+    float x;
+    float y;
+    float z;
+    float w;
+    float r;
+    float g;
+    float b;
+} _dpClipVertex;
+
+typedef struct _dpRasterJobStruct {
+    dpRaster *dpraster;
+    dpBuffer *dpbuf;
+} _dpRasterJob;
+
+static float _dpraster_light(dpRaster *dpraster, const dpVec3 normal) {
+    float d = -dpvec3_dot(normal, dpraster->light);
+    return dpraster->ambient + (1.0f - dpraster->ambient) * (d > 0.0f ? d : 0.0f);
+}
+
+static _dpClipVertex _dpraster_lerpVertex(const _dpClipVertex a, const _dpClipVertex b, const float t) {
+    _dpClipVertex v = {
+        a.x + (b.x - a.x) * t,
+        a.y + (b.y - a.y) * t,
+        a.z + (b.z - a.z) * t,
+        a.w + (b.w - a.w) * t,
+        a.r + (b.r - a.r) * t,
+        a.g + (b.g - a.g) * t,
+        a.b + (b.b - a.b) * t
+    };
+    return v;
+}
+
+/* Signed distance to one of the six frustum planes, inside is >= 0 */
+static float _dpraster_planeDistance(const _dpClipVertex v, const uint32_t plane) {
+    switch(plane) {
+        case 0: return v.w + v.x;
+        case 1: return v.w - v.x;
+        case 2: return v.w + v.y;
+        case 3: return v.w - v.y;
+        case 4: return v.w + v.z;
+        default: return v.w - v.z;
+    }
+}
+
+/* Sutherland-Hodgman against every plane the polygon crosses, returns the new vertex count */
+static uint32_t _dpraster_clip(_dpClipVertex *poly, uint32_t count) {
+    _dpClipVertex temp[9];
+    uint32_t plane, i, n;
+    float da, db;
+    for(plane = 0; plane < 6 && count >= 3; plane++) {
+        n = 0;
+        for(i = 0; i < count; i++) {
+            const _dpClipVertex a = poly[i], b = poly[(i + 1) % count];
+            da = _dpraster_planeDistance(a, plane);
+            db = _dpraster_planeDistance(b, plane);
+            if(da >= 0.0f)
+                temp[n++] = a;
+            if((da >= 0.0f) != (db >= 0.0f))
+                temp[n++] = _dpraster_lerpVertex(a, b, da / (da - db));
+        }
+        memcpy(poly, temp, sizeof(_dpClipVertex) * n);
+        count = n;
+    }
+    return count;
+}
+
+static _dpTriangle *_dpraster_newTriangle(dpRaster *dpraster) {
+    if(dpraster->trianglecount == dpraster->trianglecapacity) {
+        dpraster->trianglecapacity = dpraster->trianglecapacity ? dpraster->trianglecapacity * 2 : 256;
+        dpraster->triangles = realloc(dpraster->triangles, sizeof(_dpTriangle) * dpraster->trianglecapacity);
+    }
+    return &dpraster->triangles[dpraster->trianglecount++];
+}
+
+static void _dpraster_setup(dpRaster *dpraster, const _dpClipVertex *v0, const _dpClipVertex *v1, const _dpClipVertex *v2, const dpPixel color) {
+    const _dpClipVertex *v[3] = { v0, v1, v2 }, *tv;
+    const float hw = dpraster->width * 0.5f, hh = dpraster->height * 0.5f;
+    float sx[3], sy[3], sz[3], attr[3], det, dx1, dy1, dx2, dy2, f;
+    int32_t fx[3], fy[3];
+    int64_t area;
+    uint32_t i, j, k;
+    _dpTriangle *tri;
+    for(i = 0; i < 3; i++) {
+        f = 1.0f / v[i]->w;
+        fx[i] = (int32_t)floorf((v[i]->x * f + 1.0f) * hw * DP_RASTER_SUBPIXEL + 0.5f);
+        fy[i] = (int32_t)floorf((1.0f - v[i]->y * f) * hh * DP_RASTER_SUBPIXEL + 0.5f);
+        sz[i] = v[i]->z * f * 0.5f + 0.5f;
+    }
+    area = (int64_t)(fx[1] - fx[0]) * (fy[2] - fy[0]) - (int64_t)(fx[2] - fx[0]) * (fy[1] - fy[0]);
+    if(area == 0)
+        return;
+    if(area > 0) {
+        /* Clockwise on screen, which is the back side */
+        if(dpraster->culling)
+            return;
+    } else {
+        tv = v[1]; v[1] = v[2]; v[2] = tv;
+        f = sz[1]; sz[1] = sz[2]; sz[2] = f;
+        i = (uint32_t)fx[1]; fx[1] = fx[2]; fx[2] = (int32_t)i;
+        i = (uint32_t)fy[1]; fy[1] = fy[2]; fy[2] = (int32_t)i;
+    }
+    tri = _dpraster_newTriangle(dpraster);
+    tri->minx = fx[0] < fx[1] ? (fx[0] < fx[2] ? fx[0] : fx[2]) : (fx[1] < fx[2] ? fx[1] : fx[2]);
+    tri->miny = fy[0] < fy[1] ? (fy[0] < fy[2] ? fy[0] : fy[2]) : (fy[1] < fy[2] ? fy[1] : fy[2]);
+    tri->maxx = fx[0] > fx[1] ? (fx[0] > fx[2] ? fx[0] : fx[2]) : (fx[1] > fx[2] ? fx[1] : fx[2]);
+    tri->maxy = fy[0] > fy[1] ? (fy[0] > fy[2] ? fy[0] : fy[2]) : (fy[1] > fy[2] ? fy[1] : fy[2]);
+    tri->minx = tri->minx / DP_RASTER_SUBPIXEL;
+    tri->miny = tri->miny / DP_RASTER_SUBPIXEL;
+    tri->maxx = tri->maxx / DP_RASTER_SUBPIXEL + 1;
+    tri->maxy = tri->maxy / DP_RASTER_SUBPIXEL + 1;
+    for(i = 0; i < 3; i++) {
+        j = (i + 1) % 3;
+        tri->a[i] = (int64_t)fy[i] - fy[j];
+        tri->b[i] = (int64_t)fx[j] - fx[i];
+        tri->c[i] = -(tri->a[i] * fx[i] + tri->b[i] * fy[i]);
+        /* Top-left rule, pixels exactly on any other edge belong to the neighbour */
+        if(!((fy[j] == fy[i] && fx[j] > fx[i]) || fy[j] < fy[i]))
+            tri->c[i]--;
+    }
+    tri->zmin = sz[0] < sz[1] ? (sz[0] < sz[2] ? sz[0] : sz[2]) : (sz[1] < sz[2] ? sz[1] : sz[2]);
+    tri->zmax = sz[0] > sz[1] ? (sz[0] > sz[2] ? sz[0] : sz[2]) : (sz[1] > sz[2] ? sz[1] : sz[2]);
+    tri->flat = dpraster->shading == DP_SHADE_FLAT;
+    tri->color = color;
+    /* Planes are evaluated at pixel centers using the snapped positions */
+    for(i = 0; i < 3; i++) {
+        sx[i] = (float)fx[i] / DP_RASTER_SUBPIXEL - 0.5f;
+        sy[i] = (float)fy[i] / DP_RASTER_SUBPIXEL - 0.5f;
+    }
+    dx1 = sx[1] - sx[0];
+    dy1 = sy[1] - sy[0];
+    dx2 = sx[2] - sx[0];
+    dy2 = sy[2] - sy[0];
+    det = dx1 * dy2 - dx2 * dy1;
+    for(k = 0; k < 4; k++) {
+        for(i = 0; i < 3; i++)
+            attr[i] = k == 0 ? sz[i] : (k == 1 ? v[i]->r : (k == 2 ? v[i]->g : v[i]->b));
+        tri->planes[k][0] = ((attr[1] - attr[0]) * dy2 - (attr[2] - attr[0]) * dy1) / det;
+        tri->planes[k][1] = ((attr[2] - attr[0]) * dx1 - (attr[1] - attr[0]) * dx2) / det;
+        tri->planes[k][2] = attr[0] - tri->planes[k][0] * sx[0] - tri->planes[k][1] * sy[0];
+    }
+}
+
+static void _dpraster_bin(dpRaster *dpraster) {
+    const uint32_t tiles = dpraster->tilesx * dpraster->tilesy;
+    const int32_t lastx = (int32_t)dpraster->tilesx - 1, lasty = (int32_t)dpraster->tilesy - 1;
+    const _dpTriangle *tri;
+    int32_t tx, ty, tx0, ty0, tx1, ty1;
+    uint32_t t, pass, total = 0;
+    /* Count per tile, turn the counts into offsets, then fill in submission order */
+    memset(dpraster->binstart, 0, sizeof(uint32_t) * (tiles + 1));
+    for(pass = 0; pass < 2; pass++) {
+        for(t = 0; t < dpraster->trianglecount; t++) {
+            tri = &dpraster->triangles[t];
+            tx0 = tri->minx / DP_RASTER_TILE;
+            ty0 = tri->miny / DP_RASTER_TILE;
+            tx1 = (tri->maxx - 1) / DP_RASTER_TILE;
+            ty1 = (tri->maxy - 1) / DP_RASTER_TILE;
+            tx0 = tx0 < 0 ? 0 : tx0;
+            ty0 = ty0 < 0 ? 0 : ty0;
+            tx1 = tx1 > lastx ? lastx : tx1;
+            ty1 = ty1 > lasty ? lasty : ty1;
+            for(ty = ty0; ty <= ty1; ty++) {
+                for(tx = tx0; tx <= tx1; tx++) {
+                    if(pass == 0)
+                        dpraster->binstart[(uint32_t)(ty * (lastx + 1) + tx) + 1]++;
+                    else
+                        dpraster->bins[dpraster->binstart[(uint32_t)(ty * (lastx + 1) + tx)]++] = t;
+                }
+            }
+        }
+        if(pass == 0) {
+            for(t = 1; t <= tiles; t++)
+                dpraster->binstart[t] += dpraster->binstart[t - 1];
+            total = dpraster->binstart[tiles];
+            if(total > dpraster->bincapacity) {
+                dpraster->bincapacity = total;
+                dpraster->bins = realloc(dpraster->bins, sizeof(uint32_t) * total);
+            }
+        }
+    }
+    /* The fill moved every start up to the next tile's start */
+    for(t = tiles; t > 0; t--)
+        dpraster->binstart[t] = dpraster->binstart[t - 1];
+    dpraster->binstart[0] = 0;
+}
+
+static uint8_t _dpraster_channel(const float c) {
+    return (uint8_t)(c <= 0.0f ? 0.0f : (c >= 255.0f ? 255.0f : c + 0.5f));
+}
+
+static void _dpraster_tileJob(void *data, const uint32_t job) {
+    _dpRasterJob *rj = (_dpRasterJob *)data;
+    dpRaster *dpraster = rj->dpraster;
+    dpBuffer *dpbuf = rj->dpbuf;
+    const int32_t tx0 = (int32_t)((job % dpraster->tilesx) * DP_RASTER_TILE);
+    const int32_t ty0 = (int32_t)((job / dpraster->tilesx) * DP_RASTER_TILE);
+    const int32_t width = (int32_t)(dpraster->width < dpbuf->width ? dpraster->width : dpbuf->width);
+    const int32_t height = (int32_t)(dpraster->height < dpbuf->height ? dpraster->height : dpbuf->height);
+    const int32_t tx1 = tx0 + DP_RASTER_TILE < width ? tx0 + DP_RASTER_TILE : width;
+    const int32_t ty1 = ty0 + DP_RASTER_TILE < height ? ty0 + DP_RASTER_TILE : height;
+    float *tilezmax = &dpraster->tilezmax[job];
+    const _dpTriangle *tri;
+    int64_t e[3], ex, ey, cornerx[4], cornery[4];
+    float z, r, g, b, *depth;
+    dpPixel *pixels;
+    int32_t x, y, x0, y0, x1, y1, covered, outside, inside;
+    uint32_t t, i, k;
+    if(tx0 >= tx1 || ty0 >= ty1)
+        return;
+    cornerx[0] = cornerx[2] = (int64_t)tx0 * DP_RASTER_SUBPIXEL + DP_RASTER_SUBPIXEL / 2;
+    cornerx[1] = cornerx[3] = (int64_t)(tx1 - 1) * DP_RASTER_SUBPIXEL + DP_RASTER_SUBPIXEL / 2;
+    cornery[0] = cornery[1] = (int64_t)ty0 * DP_RASTER_SUBPIXEL + DP_RASTER_SUBPIXEL / 2;
+    cornery[2] = cornery[3] = (int64_t)(ty1 - 1) * DP_RASTER_SUBPIXEL + DP_RASTER_SUBPIXEL / 2;
+    for(t = dpraster->binstart[job]; t < dpraster->binstart[job + 1]; t++) {
+        tri = &dpraster->triangles[dpraster->bins[t]];
+        if(tri->zmin >= *tilezmax)
+            continue; /* <- Everything in this tile is already closer */
+        /* Tile corners against each edge, to throw the tile out or know it is fully covered */
+        covered = 1;
+        outside = 0;
+        for(i = 0; i < 3 && !outside; i++) {
+            for(k = 0, inside = 0; k < 4; k++)
+                inside += tri->a[i] * cornerx[k] + tri->b[i] * cornery[k] + tri->c[i] >= 0;
+            outside = inside == 0;
+            covered = covered && inside == 4;
+        }
+        if(outside)
+            continue;
+        x0 = tri->minx > tx0 ? tri->minx : tx0;
+        y0 = tri->miny > ty0 ? tri->miny : ty0;
+        x1 = tri->maxx < tx1 ? tri->maxx : tx1;
+        y1 = tri->maxy < ty1 ? tri->maxy : ty1;
+        for(y = y0; y < y1; y++) {
+            ey = (int64_t)y * DP_RASTER_SUBPIXEL + DP_RASTER_SUBPIXEL / 2;
+            ex = (int64_t)x0 * DP_RASTER_SUBPIXEL + DP_RASTER_SUBPIXEL / 2;
+            for(i = 0; i < 3; i++)
+                e[i] = tri->a[i] * ex + tri->b[i] * ey + tri->c[i];
+            z = tri->planes[0][0] * x0 + tri->planes[0][1] * y + tri->planes[0][2];
+            r = tri->planes[1][0] * x0 + tri->planes[1][1] * y + tri->planes[1][2];
+            g = tri->planes[2][0] * x0 + tri->planes[2][1] * y + tri->planes[2][2];
+            b = tri->planes[3][0] * x0 + tri->planes[3][1] * y + tri->planes[3][2];
+            depth = dpraster->depth + (uint32_t)y * dpraster->width;
+            pixels = dpbuf->pixels + (uint32_t)y * dpbuf->width;
+            for(x = x0; x < x1; x++) {
+                if((e[0] | e[1] | e[2]) >= 0 && z < depth[x]) {
+                    depth[x] = z;
+                    if(tri->flat) {
+                        pixels[x] = tri->color;
+                    } else {
+                        pixels[x].r = _dpraster_channel(r);
+                        pixels[x].g = _dpraster_channel(g);
+                        pixels[x].b = _dpraster_channel(b);
+                        pixels[x].a = tri->color.a;
+                    }
+                }
+                e[0] += tri->a[0] * DP_RASTER_SUBPIXEL;
+                e[1] += tri->a[1] * DP_RASTER_SUBPIXEL;
+                e[2] += tri->a[2] * DP_RASTER_SUBPIXEL;
+                z += tri->planes[0][0];
+                r += tri->planes[1][0];
+                g += tri->planes[2][0];
+                b += tri->planes[3][0];
+            }
+        }
+        /* Every pixel now holds at most the triangle's farthest depth */
+        if(covered && tri->zmax < *tilezmax)
+            *tilezmax = tri->zmax;
+    }
+}
+
+dpRaster *dpraster_create(const uint32_t width, const uint32_t height) {
+    dpRaster *dpraster = malloc(sizeof(dpRaster));
+    dpraster->width = width;
+    dpraster->height = height;
+    dpraster->depth = malloc(sizeof(float) * width * height);
+    dpraster->tilesx = (width + DP_RASTER_TILE - 1) / DP_RASTER_TILE;
+    dpraster->tilesy = (height + DP_RASTER_TILE - 1) / DP_RASTER_TILE;
+    dpraster->tilezmax = malloc(sizeof(float) * dpraster->tilesx * dpraster->tilesy);
+    dpraster->model = dpmat4_identity();
+    dpraster->viewprojection = dpmat4_identity();
+    dpraster->shading = DP_SHADE_GOURAUD;
+    dpraster->culling = 1;
+    dpraster->lighting = 0;
+    dpraster->light.x = 0.0f;
+    dpraster->light.y = 0.0f;
+    dpraster->light.z = -1.0f;
+    dpraster->ambient = 0.2f;
+    dpraster->threads = 1;
+    dpraster->triangles = NULL;
+    dpraster->trianglecount = 0;
+    dpraster->trianglecapacity = 0;
+    dpraster->binstart = malloc(sizeof(uint32_t) * (dpraster->tilesx * dpraster->tilesy + 1));
+    dpraster->bins = NULL;
+    dpraster->bincapacity = 0;
+    dpraster_clearDepth(dpraster);
+    return dpraster;
+}
+
+void dpraster_clearDepth(dpRaster *dpraster) {
+    uint32_t i;
+    for(i = 0; i < dpraster->width * dpraster->height; i++)
+        dpraster->depth[i] = 1.0f;
+    for(i = 0; i < dpraster->tilesx * dpraster->tilesy; i++)
+        dpraster->tilezmax[i] = 1.0f;
+}
+
+void dpraster_setModel(dpRaster *dpraster, const dpMat4 model) {
+    dpraster->model = model;
+}
+
+void dpraster_setViewProjection(dpRaster *dpraster, const dpMat4 viewprojection) {
+    dpraster->viewprojection = viewprojection;
+}
+
+void dpraster_setShading(dpRaster *dpraster, const int32_t shading) {
+    dpraster->shading = shading;
+}
+
+void dpraster_setCulling(dpRaster *dpraster, const int32_t culling) {
+    dpraster->culling = culling;
+}
+
+/* Direction the light travels in world space and how bright unlit sides are (0 to 1) */
+void dpraster_setLight(dpRaster *dpraster, const dpVec3 direction, const float ambient) {
+    dpraster->light = dpvec3_normalize(direction);
+    dpraster->ambient = ambient;
+}
+
+void dpraster_setLighting(dpRaster *dpraster, const int32_t lighting) {
+    dpraster->lighting = lighting;
+}
+
+void dpraster_setThreads(dpRaster *dpraster, const uint32_t threads) {
+    dpraster->threads = threads == 0 ? 1 : threads;
+}
+
+void dpraster_drawTriangles(dpRaster *dpraster, dpBuffer *dpbuf, const dpVertex *vertices, const uint32_t count) {
+    const dpMat4 mvp = dpmat4_mult(dpraster->viewprojection, dpraster->model);
+    const dpMat4 m = dpraster->model;
+    _dpClipVertex poly[9];
+    _dpRasterJob rj;
+    dpVec3 world[3], normal;
+    dpVec4 p;
+    dpPixel color;
+    float light[3];
+    uint32_t t, i, n, outcodes[3];
+    dpraster->trianglecount = 0;
+    for(t = 0; t + 3 <= count; t += 3) {
+        for(i = 0; i < 3; i++) {
+            p.x = vertices[t + i].position.x;
+            p.y = vertices[t + i].position.y;
+            p.z = vertices[t + i].position.z;
+            p.w = 1.0f;
+            p = dpmat4_transform(mvp, p);
+            poly[i].x = p.x;
+            poly[i].y = p.y;
+            poly[i].z = p.z;
+            poly[i].w = p.w;
+            outcodes[i] = 0;
+            for(n = 0; n < 6; n++)
+                outcodes[i] |= (_dpraster_planeDistance(poly[i], n) < 0.0f) << n;
+        }
+        if(outcodes[0] & outcodes[1] & outcodes[2])
+            continue; /* <- All three outside the same plane */
+        for(i = 0; i < 3; i++)
+            light[i] = 1.0f;
+        if(dpraster->lighting) {
+            if(dpraster->shading == DP_SHADE_FLAT) {
+                for(i = 0; i < 3; i++) {
+                    p.x = vertices[t + i].position.x;
+                    p.y = vertices[t + i].position.y;
+                    p.z = vertices[t + i].position.z;
+                    p.w = 1.0f;
+                    p = dpmat4_transform(m, p);
+                    world[i].x = p.x;
+                    world[i].y = p.y;
+                    world[i].z = p.z;
+                }
+                normal = dpvec3_normalize(dpvec3_cross(dpvec3_sub(world[1], world[0]), dpvec3_sub(world[2], world[0])));
+                light[0] = light[1] = light[2] = _dpraster_light(dpraster, normal);
+            } else {
+                for(i = 0; i < 3; i++) {
+                    normal.x = m.e[0] * vertices[t + i].normal.x + m.e[1] * vertices[t + i].normal.y + m.e[2] * vertices[t + i].normal.z;
+                    normal.y = m.e[4] * vertices[t + i].normal.x + m.e[5] * vertices[t + i].normal.y + m.e[6] * vertices[t + i].normal.z;
+                    normal.z = m.e[8] * vertices[t + i].normal.x + m.e[9] * vertices[t + i].normal.y + m.e[10] * vertices[t + i].normal.z;
+                    light[i] = _dpraster_light(dpraster, dpvec3_normalize(normal));
+                }
+            }
+        }
+        for(i = 0; i < 3; i++) {
+            poly[i].r = vertices[t + i].color.r * light[i];
+            poly[i].g = vertices[t + i].color.g * light[i];
+            poly[i].b = vertices[t + i].color.b * light[i];
+        }
+        color.r = _dpraster_channel((poly[0].r + poly[1].r + poly[2].r) / 3.0f);
+        color.g = _dpraster_channel((poly[0].g + poly[1].g + poly[2].g) / 3.0f);
+        color.b = _dpraster_channel((poly[0].b + poly[1].b + poly[2].b) / 3.0f);
+        color.a = vertices[t].color.a;
+        n = 3;
+        if(outcodes[0] | outcodes[1] | outcodes[2])
+            n = _dpraster_clip(poly, 3);
+        for(i = 1; i + 1 < n; i++)
+            _dpraster_setup(dpraster, &poly[0], &poly[i], &poly[i + 1], color);
+    }
+    if(dpraster->trianglecount == 0)
+        return;
+    _dpraster_bin(dpraster);
+    rj.dpraster = dpraster;
+    rj.dpbuf = dpbuf;
+    _dp_runJobs(_dpraster_tileJob, &rj, dpraster->tilesx * dpraster->tilesy,
+        dpraster->width * dpraster->height >= DP_PARALLEL_MIN_PIXELS ? dpraster->threads : 1);
+}
+
+void dpraster_destroy(dpRaster *dpraster) {
+    free(dpraster->triangles);
+    free(dpraster->binstart);
+    free(dpraster->bins);
+    free(dpraster->tilezmax);
+    free(dpraster->depth);
+    free(dpraster);
+}
+
 
 /* Drawing functions */
 
-struct _gfxstruct_ {
-    dpMat3 transform;
+typedef struct _dpGfxStateStruct {
+    dpMat3 parent;
     dpMat3 translate;
     dpMat3 scale;
     dpMat3 rotate;
+} _dpGfxState;
+
+typedef struct dpGfxContextStruct {
+    dpBuffer *target;
     dpPixel color;
-} _gfx_;
+    int32_t blendmode;
+    int32_t clipped;
+    _dpRect clip;
+    _dpGfxState state;
+    dpMat3 transform; /* <- Cached parent * translate * rotate * scale */
+    int32_t dirty; /* <- Set whenever a component changes, the product is redone on next use */
+    _dpGfxState stack[DP_GFX_STACK_DEPTH];
+    uint32_t depth;
+} dpGfxContext;
+
+/* Clip rectangle limited to the target, in pixels */
+static _dpRect _dpgfx_bounds(dpGfxContext *dpgfx) {
+    _dpRect r = _dprect_make(0, 0, dpgfx->target->width, dpgfx->target->height);
+    return dpgfx->clipped ? _dprect_intersect(r, dpgfx->clip) : r;
+}
+
+static void _dpgfx_fillSpan(dpGfxContext *dpgfx, const int32_t x, const int32_t y, const uint32_t count) {
+    _dpbuf_fill(dpgfx->target, x, y, (int32_t)count, 1, dpgfx->color, dpgfx->blendmode);
+}
+
+dpGfxContext *dpgfx_create(dpBuffer *dpbuf) {
+    dpGfxContext *dpgfx = malloc(sizeof(dpGfxContext));
+    dpgfx->target = dpbuf;
+    dpgfx->color = dppix_hex(0xFFFFFF);
+    dpgfx->blendmode = DP_BLEND_COPY;
+    dpgfx->clipped = 0;
+    dpgfx->state.parent = dpmat3_identity();
+    dpgfx->state.translate = dpmat3_identity();
+    dpgfx->state.scale = dpmat3_identity();
+    dpgfx->state.rotate = dpmat3_identity();
+    dpgfx->transform = dpmat3_identity();
+    dpgfx->dirty = 0;
+    dpgfx->depth = 0;
+    return dpgfx;
+}
+
+void dpgfx_setTarget(dpGfxContext *dpgfx, dpBuffer *dpbuf) {
+    dpgfx->target = dpbuf;
+}
+
+void dpgfx_setColor(dpGfxContext *dpgfx, const dpPixel color) {
+    dpgfx->color = color;
+}
+
+void dpgfx_setBlendMode(dpGfxContext *dpgfx, const int32_t blendmode) {
+    dpgfx->blendmode = blendmode;
+}
+
+void dpgfx_setClip(dpGfxContext *dpgfx, const int32_t x, const int32_t y, const uint32_t width, const uint32_t height) {
+    dpgfx->clip = _dprect_make(x, y, x + (int32_t)width, y + (int32_t)height);
+    dpgfx->clipped = 1;
+}
+
+void dpgfx_resetClip(dpGfxContext *dpgfx) {
+    dpgfx->clipped = 0;
+}
+
+void dpgfx_setTranslate(dpGfxContext *dpgfx, const float tx, const float ty) {
+    dpgfx->state.translate = dpmat3_translate(tx, ty);
+    dpgfx->dirty = 1;
+}
+
+void dpgfx_setScale(dpGfxContext *dpgfx, const float sx, const float sy) {
+    dpgfx->state.scale = dpmat3_scale(sx, sy);
+    dpgfx->dirty = 1;
+}
+
+void dpgfx_setRotate(dpGfxContext *dpgfx, const float r) {
+    dpgfx->state.rotate = dpmat3_rotate(r);
+    dpgfx->dirty = 1;
+}
+
+int32_t dpgfx_push(dpGfxContext *dpgfx) {
+    if(dpgfx->depth == DP_GFX_STACK_DEPTH)
+        return 0;
+    dpgfx->stack[dpgfx->depth++] = dpgfx->state;
+    dpgfx->state.parent = dpgfx_getTransform(dpgfx);
+    dpgfx->state.translate = dpmat3_identity();
+    dpgfx->state.scale = dpmat3_identity();
+    dpgfx->state.rotate = dpmat3_identity();
+    return 1; /* <- Transform is unchanged, so no need to mark it dirty */
+}
+
+int32_t dpgfx_pop(dpGfxContext *dpgfx) {
+    if(dpgfx->depth == 0)
+        return 0;
+    dpgfx->state = dpgfx->stack[--dpgfx->depth];
+    dpgfx->dirty = 1;
+    return 1;
+}
+
+dpMat3 dpgfx_getTransform(dpGfxContext *dpgfx) {
+    if(dpgfx->dirty) {
+        dpgfx->transform = dpmat3_mult(dpgfx->state.parent,
+            dpmat3_mult(dpgfx->state.translate, dpmat3_mult(dpgfx->state.rotate, dpgfx->state.scale)));
+        dpgfx->dirty = 0;
+    }
+    return dpgfx->transform;
+}
+
+dpVec2 dpgfx_transformPoint(dpGfxContext *dpgfx, const dpVec2 p) {
+    const dpMat3 m = dpgfx_getTransform(dpgfx);
+    dpVec2 v = {
+        m.e[0] * p.x + m.e[1] * p.y + m.e[2],
+        m.e[3] * p.x + m.e[4] * p.y + m.e[5]
+    };
+    return v;
+}
+
+/* Fills the whole clip rectangle, ignoring the transform */
+void dpgfx_clear(dpGfxContext *dpgfx) {
+    const _dpRect r = _dpgfx_bounds(dpgfx);
+    if(_dprect_isEmpty(r))
+        return;
+    _dpbuf_fill(dpgfx->target, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, dpgfx->color, dpgfx->blendmode);
+}
+
+void dpgfx_putPixel(dpGfxContext *dpgfx, const float x, const float y) {
+    const _dpRect r = _dpgfx_bounds(dpgfx);
+    dpVec2 p = { x, y };
+    int32_t px, py;
+    p = dpgfx_transformPoint(dpgfx, p);
+    px = (int32_t)floorf(p.x);
+    py = (int32_t)floorf(p.y);
+    if(px < r.x0 || py < r.y0 || px >= r.x1 || py >= r.y1)
+        return;
+    _dpgfx_fillSpan(dpgfx, px, py, 1);
+}
+
+/*
+ *  The rectangle goes through the transform as a quad, so it can come out rotated.
+ *  Every row is filled between the leftmost and rightmost crossing of the quad's
+ *  edges through the pixel centers of that row.
+ */
+void dpgfx_fillRect(dpGfxContext *dpgfx, const float x, const float y, const float width, const float height) {
+    const _dpRect r = _dpgfx_bounds(dpgfx);
+    dpVec2 quad[4] = { { x, y }, { x + width, y }, { x + width, y + height }, { x, y + height } };
+    float miny, maxy, cy, left, right, t;
+    int32_t row, y0, y1, x0, x1;
+    uint32_t i, j;
+    for(i = 0; i < 4; i++)
+        quad[i] = dpgfx_transformPoint(dpgfx, quad[i]);
+    miny = maxy = quad[0].y;
+    for(i = 1; i < 4; i++) {
+        miny = quad[i].y < miny ? quad[i].y : miny;
+        maxy = quad[i].y > maxy ? quad[i].y : maxy;
+    }
+    y0 = (int32_t)ceilf(miny - 0.5f);
+    y1 = (int32_t)ceilf(maxy - 0.5f);
+    y0 = y0 < r.y0 ? r.y0 : y0;
+    y1 = y1 > r.y1 ? r.y1 : y1;
+    for(row = y0; row < y1; row++) {
+        cy = row + 0.5f;
+        left = 1e30f;
+        right = -1e30f;
+        for(i = 0; i < 4; i++) {
+            j = (i + 1) % 4;
+            if((quad[i].y <= cy) == (quad[j].y <= cy))
+                continue; /* <- Edge does not cross this row */
+            t = quad[i].x + (cy - quad[i].y) * (quad[j].x - quad[i].x) / (quad[j].y - quad[i].y);
+            left = t < left ? t : left;
+            right = t > right ? t : right;
+        }
+        if(left > right)
+            continue;
+        x0 = (int32_t)ceilf(left - 0.5f);
+        x1 = (int32_t)ceilf(right - 0.5f);
+        x0 = x0 < r.x0 ? r.x0 : x0;
+        x1 = x1 > r.x1 ? r.x1 : x1;
+        if(x0 < x1)
+            _dpgfx_fillSpan(dpgfx, x0, row, (uint32_t)(x1 - x0));
+    }
+}
+
+void dpgfx_destroy(dpGfxContext *dpgfx) {
+    free(dpgfx);
+}
 
 
 
@@ -23,6 +23,13 @@
 /* Handles */
 typedef struct dpWindowStruct dpWindow;
 typedef struct dpBufferStruct dpBuffer;
+typedef struct dpLayerStruct dpLayer;
+typedef struct dpCompositorStruct dpCompositor;
+typedef struct dpFilterStruct dpFilter;
+typedef struct dpRasterStruct dpRaster;
+typedef struct dpGfxContextStruct dpGfxContext;
+typedef struct dpTilemapStruct dpTilemap;
+typedef struct dpRecorderStruct dpRecorder;
 typedef struct dpPixelStruct {
     union {
         struct {
@@ -80,12 +87,146 @@ void dpbuf_putPixel(dpBuffer *, const int32_t, const int32_t, const dpPixel);
 void dpbuf_putPixel3(dpBuffer *, const int32_t, const int32_t, const uint8_t, const uint8_t, const uint8_t);
 void dpbuf_putPixel4(dpBuffer *, const int32_t, const int32_t, const uint8_t, const uint8_t, const uint8_t, const uint8_t);
 
+void dpbuf_fill(dpBuffer *, const int32_t, const int32_t, const uint32_t, const uint32_t, const dpPixel);
+void dpbuf_blit(dpBuffer *, dpBuffer *, const int32_t, const int32_t, const int32_t, const int32_t, const uint32_t, const uint32_t);
+
 void dpbuf_setClearColor(dpBuffer *, const dpPixel);
 
 dpPixel *dpbuf_getPixelPointer(dpBuffer *);
 
 void dpbuf_destroy(dpBuffer *);
 
+/* Compositor functions */
+
+/*
+ *  Blend modes for layers. Every mode is scaled by the layer opacity.
+ *  Keep in mind dppix_rgb() leaves alpha at 0, so DP_BLEND_ALPHA only makes
+ *  sense for layers drawn with dppix_rgba() or dpbuf_putPixel4().
+ */
+#define DP_BLEND_COPY     0 /* Layer replaces what is under it */
+#define DP_BLEND_ALPHA    1 /* Layer is weighted by its own alpha channel */
+#define DP_BLEND_ADD      2 /* Layer is added on top (saturates at 255) */
+#define DP_BLEND_MULTIPLY 3 /* Layer darkens what is under it */
+
+dpCompositor *dpcomp_create(const uint32_t, const uint32_t);
+
+dpLayer *dpcomp_addLayer(dpCompositor *, const uint32_t, const uint32_t, const int32_t);
+void dpcomp_removeLayer(dpCompositor *, dpLayer *);
+
+uint32_t dpcomp_composite(dpCompositor *);
+void dpcomp_damageAll(dpCompositor *);
+
+void dpcomp_setThreads(dpCompositor *, const uint32_t);
+
+dpBuffer *dpcomp_getBuffer(dpCompositor *);
+
+void dpcomp_destroy(dpCompositor *);
+
+void dplayer_damage(dpLayer *, const int32_t, const int32_t, const uint32_t, const uint32_t);
+void dplayer_damageAll(dpLayer *);
+
+void dplayer_setOffset(dpLayer *, const int32_t, const int32_t);
+void dplayer_setZ(dpLayer *, const int32_t);
+void dplayer_setOpacity(dpLayer *, const uint8_t);
+void dplayer_setBlendMode(dpLayer *, const int32_t);
+void dplayer_setVisible(dpLayer *, const int32_t);
+
+dpBuffer *dplayer_getBuffer(dpLayer *);
+
+/* Filter functions */
+
+/*
+ *  A filter is a chain of passes run over a buffer in place by dpfilter_apply().
+ *  Passes run in the order they are added. Blurs take a radius of up to 127 and
+ *  LUT/palette data is copied, so the caller's arrays can be freed afterwards.
+ *  The add functions return 0 when the pass could not be added.
+ */
+dpFilter *dpfilter_create();
+
+int32_t dpfilter_addBoxBlur(dpFilter *, const uint32_t);
+int32_t dpfilter_addGaussianBlur(dpFilter *, const float);
+int32_t dpfilter_addLut1D(dpFilter *, const uint8_t *, const uint8_t *, const uint8_t *);
+int32_t dpfilter_addLut3D(dpFilter *, const dpPixel *, const uint32_t);
+int32_t dpfilter_addScanlines(dpFilter *, const uint32_t, const uint8_t);
+int32_t dpfilter_addMask(dpFilter *, const uint8_t);
+int32_t dpfilter_addQuantize(dpFilter *, const dpPixel *, const uint32_t);
+
+void dpfilter_setThreads(dpFilter *, const uint32_t);
+
+void dpfilter_apply(dpFilter *, dpBuffer *);
+
+void dpfilter_destroy(dpFilter *);
+
+/* Tilemap functions */
+
+/*
+ *  A tilemap is a grid of tile indices drawn from a tileset buffer, where tiles are
+ *  numbered left to right, top to bottom. The map is prerendered in chunks of
+ *  DP_TILEMAP_CHUNK by DP_TILEMAP_CHUNK tiles which are only redrawn when one of
+ *  their tiles changes, so drawing is one dpbuf_blit per visible chunk.
+ *  Call dptilemap_invalidate() after changing the tileset's pixels.
+ */
+#define DP_TILEMAP_CHUNK 16
+#define DP_TILE_EMPTY 0xFFFF /* <- Drawn with the tilemap's clear color */
+
+dpTilemap *dptilemap_create(const uint32_t, const uint32_t, dpBuffer *, const uint32_t, const uint32_t);
+
+void dptilemap_setTile(dpTilemap *, const uint32_t, const uint32_t, const uint16_t);
+void dptilemap_setTiles(dpTilemap *, const uint16_t *);
+uint16_t dptilemap_getTile(dpTilemap *, const uint32_t, const uint32_t);
+
+void dptilemap_setClearColor(dpTilemap *, const dpPixel);
+void dptilemap_setCacheSize(dpTilemap *, const uint32_t);
+void dptilemap_invalidate(dpTilemap *);
+
+void dptilemap_draw(dpTilemap *, dpBuffer *, const int32_t, const int32_t);
+
+void dptilemap_destroy(dpTilemap *);
+
+/* Recording functions */
+
+/*
+ *  A recorder writes a binary command stream of everything drawn into the buffers
+ *  attached to it: clears, batches of putPixel calls, fills (dpbuf_fill and graphics
+ *  context spans) and blits (dpbuf_blit and tilemaps), plus the input state after
+ *  every dpwin_tick of an attached window and a frame marker on every dpwin_putBuffer.
+ *  Attaching a buffer stores its current pixels. Pixels written any other way (like
+ *  through dpbuf_getPixelPointer) are not seen, call dprec_snapshot() after those.
+ *  Blitting from a buffer that is not attached attaches it. A recorder, and the
+ *  buffers attached to it, must only be used from one thread.
+ *
+ *  dprec_replay() runs a stream again without a window, as fast as possible, and
+ *  fills in the time spent per command type and hashes of the presented frames.
+ */
+#define DP_CMD_BUFFER   0 /* <- A buffer was attached */
+#define DP_CMD_SNAPSHOT 1 /* <- Every pixel of a buffer */
+#define DP_CMD_CLEAR    2
+#define DP_CMD_PIXELS   3
+#define DP_CMD_FILL     4
+#define DP_CMD_BLIT     5
+#define DP_CMD_INPUT    6
+#define DP_CMD_FRAME    7
+#define DP_CMD_COUNT    8
+
+typedef struct dpReplayStatsStruct {
+    uint32_t counts[DP_CMD_COUNT];
+    double seconds[DP_CMD_COUNT];
+    uint32_t frames;
+    uint64_t framehash; /* <- Hash of the last presented frame */
+    uint64_t streamhash; /* <- Hash of every presented frame in order */
+} dpReplayStats;
+
+dpRecorder *dprec_create(const char *);
+
+void dprec_attachBuffer(dpRecorder *, dpBuffer *);
+void dprec_attachWindow(dpRecorder *, dpWindow *);
+void dprec_snapshot(dpRecorder *, dpBuffer *);
+void dprec_flush(dpRecorder *);
+
+void dprec_destroy(dpRecorder *);
+
+int32_t dprec_replay(const char *, dpReplayStats *);
+
 
 /* Math section */
 
@@ -98,9 +239,18 @@ typedef struct dpVec3Struct {
     float y;
     float z;
 } dpVec3;
+typedef struct dpVec4Struct {
+    float x;
+    float y;
+    float z;
+    float w;
+} dpVec4;
 typedef struct dpMat3Struct {
     float e[9];
 } dpMat3;
+typedef struct dpMat4Struct {
+    float e[16]; /* <- Row major like dpMat3, vectors are multiplied on the right */
+} dpMat4;
 
 dpVec2 dpvec2_add(const dpVec2, const dpVec2);
 dpVec2 dpvec2_sub(const dpVec2, const dpVec2);
@@ -130,8 +280,81 @@ dpMat3 dpmat3_add(const dpMat3, const dpMat3);
 dpMat3 dpmat3_sub(const dpMat3, const dpMat3);
 dpMat3 dpmat3_mult(const dpMat3, const dpMat3);
 
+dpMat4 dpmat4_identity();
+dpMat4 dpmat4_translate(const float, const float, const float);
+dpMat4 dpmat4_scale(const float, const float, const float);
+dpMat4 dpmat4_rotateX(const float);
+dpMat4 dpmat4_rotateY(const float);
+dpMat4 dpmat4_rotateZ(const float);
+dpMat4 dpmat4_perspective(const float, const float, const float, const float);
+dpMat4 dpmat4_lookAt(const dpVec3, const dpVec3, const dpVec3);
+dpMat4 dpmat4_mult(const dpMat4, const dpMat4);
+dpVec4 dpmat4_transform(const dpMat4, const dpVec4);
+
+/* 3D section */
+
+#define DP_SHADE_FLAT    0 /* <- One color per triangle, lit by the face normal */
+#define DP_SHADE_GOURAUD 1 /* <- Vertex colors lit per vertex and interpolated */
+
+typedef struct dpVertexStruct {
+    dpVec3 position;
+    dpVec3 normal; /* <- Only used for Gouraud lighting */
+    dpPixel color;
+} dpVertex;
+
+/*
+ *  A raster owns the depth buffer for a render target of the given size and draws
+ *  lists of triangles (three vertices each) into a dpBuffer. Triangles facing away
+ *  (clockwise after projection) are culled unless culling is turned off.
+ */
+dpRaster *dpraster_create(const uint32_t, const uint32_t);
+
+void dpraster_clearDepth(dpRaster *);
+
+void dpraster_setModel(dpRaster *, const dpMat4);
+void dpraster_setViewProjection(dpRaster *, const dpMat4);
+void dpraster_setShading(dpRaster *, const int32_t);
+void dpraster_setCulling(dpRaster *, const int32_t);
+void dpraster_setLight(dpRaster *, const dpVec3, const float);
+void dpraster_setLighting(dpRaster *, const int32_t);
+void dpraster_setThreads(dpRaster *, const uint32_t);
+
+void dpraster_drawTriangles(dpRaster *, dpBuffer *, const dpVertex *, const uint32_t);
+
+void dpraster_destroy(dpRaster *);
+
 /* Drawing funcion section */
-/* Not yet added */
+
+/*
+ *  A graphics context holds all drawing state: the target buffer, color, blend mode
+ *  (DP_BLEND_*), clip rectangle and transform. Nothing is shared between contexts,
+ *  so each thread can draw into its own buffer with its own context.
+ *  The transform is parent * translate * rotate * scale. The setters replace one
+ *  component, push saves the state and makes the current transform the new parent,
+ *  and pop brings the saved state back.
+ */
+dpGfxContext *dpgfx_create(dpBuffer *);
+
+void dpgfx_setTarget(dpGfxContext *, dpBuffer *);
+void dpgfx_setColor(dpGfxContext *, const dpPixel);
+void dpgfx_setBlendMode(dpGfxContext *, const int32_t);
+void dpgfx_setClip(dpGfxContext *, const int32_t, const int32_t, const uint32_t, const uint32_t);
+void dpgfx_resetClip(dpGfxContext *);
+
+void dpgfx_setTranslate(dpGfxContext *, const float, const float);
+void dpgfx_setScale(dpGfxContext *, const float, const float);
+void dpgfx_setRotate(dpGfxContext *, const float);
+int32_t dpgfx_push(dpGfxContext *);
+int32_t dpgfx_pop(dpGfxContext *);
+
+dpMat3 dpgfx_getTransform(dpGfxContext *);
+dpVec2 dpgfx_transformPoint(dpGfxContext *, const dpVec2);
+
+void dpgfx_clear(dpGfxContext *);
+void dpgfx_putPixel(dpGfxContext *, const float, const float);
+void dpgfx_fillRect(dpGfxContext *, const float, const float, const float, const float);
+
+void dpgfx_destroy(dpGfxContext *);
 
 
 #endif /* End file */
@@ -0,0 +1,57 @@
+/*
+ *  This is the Direct Pixels replay tool.
+ *  It runs a stream written by a dpRecorder without opening a window
+ *  and prints how much time went into each kind of draw command, so
+ *  renderer changes can be measured and compared on the same workload.
+ *
+ *  Usage: dpreplay <stream> [runs]
+ *
+ *  Build it next to the library, for example:
+ *      cc -O2 dpreplay.c directpixels.c -o dpreplay -lm -lpthread
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "directpixels.h"
+
+static const char *_names[DP_CMD_COUNT] = { "buffer", "snapshot", "clear", "pixels", "fill", "blit", "input", "frame" };
+
+int main(int argc, char **argv) {
+    dpReplayStats stats, total;
+    int32_t runs = argc > 2 ? atoi(argv[2]) : 1, run, i;
+    double seconds = 0.0;
+    if(argc < 2) {
+        printf("Usage: %s <stream> [runs]\n", argv[0]);
+        return 1;
+    }
+    if(runs < 1)
+        runs = 1;
+    for(run = 0; run < runs; run++) {
+        if(!dprec_replay(argv[1], &stats)) {
+            printf("Could not replay \"%s\"\n", argv[1]);
+            return 1;
+        }
+        if(run == 0)
+            total = stats;
+        else if(stats.streamhash != total.streamhash) {
+            printf("Run %d presented different frames\n", (int)run); /* <- Replays must be deterministic */
+            return 1;
+        } else {
+            for(i = 0; i < DP_CMD_COUNT; i++)
+                total.seconds[i] += stats.seconds[i];
+        }
+    }
+    printf("%-10s %10s %12s %12s\n", "command", "count", "total ms", "avg us");
+    for(i = 0; i < DP_CMD_COUNT; i++) {
+        seconds += total.seconds[i] / runs;
+        if(total.counts[i] == 0)
+            continue;
+        printf("%-10s %10u %12.3f %12.3f\n", _names[i], (unsigned)total.counts[i],
+            total.seconds[i] / runs * 1e3, total.seconds[i] / runs / total.counts[i] * 1e6);
+    }
+    printf("%-10s %10s %12.3f\n", "total", "", seconds * 1e3);
+    printf("frames %u, last frame %016llx, stream %016llx\n", (unsigned)total.frames,
+        (unsigned long long)total.framehash, (unsigned long long)total.streamhash);
+    return 0;
+}